@@ -8,6 +8,9 @@
 #include "korg_syro_volcasample.h"
 #include "korg_syro_func.h"
 #include "korg_syro_comp.h"
+#include "korg_syro_thread.h"
+
+#define COMP_PARALLEL_BATCH		256
 
 typedef struct {
 	const uint8_t *ptr;
@@ -24,6 +27,8 @@ typedef struct {
 	int ByteCount;
 } WriteBit;
 
+static const SyroCompCache *comp_cache = NULL;
+
 
 /*-----------------------------------------------------------------------------
 	Write Bit
@@ -340,19 +345,25 @@ static int SyroComp_MakeMap_SingleType(uint8_t *map_buffer, ReadSample *prp, int
 /*-----------------------------------------------------------------------------
 	make map, get size
 	 -- keep prp->ptr
+	 -- the map of both types is kept, so the best one is not made again.
  -----------------------------------------------------------------------------*/
 static int SyroComp_MakeMap(uint8_t *map_buffer, ReadSample *prp, int *pBitBase, int *ptype)
 {
 	int i;
 	int besttype;
 	int len, bestlen;
-	int BitBase[4];
+	int BitBase[2][4];
+	uint8_t map_buffer2[VOLCASAMPLE_COMP_BLOCK_LEN];
+	uint8_t *pmap[2];
+	
+	pmap[0] = map_buffer;
+	pmap[1] = map_buffer2;
 	
 	bestlen = 0;
 	besttype = 0;
 	
 	for (i=0; i<2; i++) {
-		len = SyroComp_MakeMap_SingleType(map_buffer, prp, BitBase, (i*2));	// type=0 or 2
+		len = SyroComp_MakeMap_SingleType(pmap[i], prp, BitBase[i], (i*2));	// type=0 or 2
 		
 		if ((!bestlen) || (len < bestlen)) {
 			bestlen = len;
@@ -361,7 +372,12 @@ static int SyroComp_MakeMap(uint8_t *map_buffer, ReadSample *prp, int *pBitBase,
 	}
 	
 	if (pBitBase && ptype) {
-		bestlen = SyroComp_MakeMap_SingleType(map_buffer, prp, pBitBase, (besttype*2));
+		if (besttype) {
+			memcpy(map_buffer, map_buffer2, VOLCASAMPLE_COMP_BLOCK_LEN);
+		}
+		for (i=0; i<4; i++) {
+			pBitBase[i] = BitBase[besttype][i];
+		}
 		*ptype = (besttype ? 2 : 0);
 	}
 
@@ -456,6 +472,105 @@ static int SyroComp_CompBlock(uint8_t *map_buffer, uint8_t *dest, ReadSample *pr
 }
 
 
+/*-----------------------------------------------------------------------------
+	Encode single block, with header & checksum
+	 ret : byte size written to pdest.
+ -----------------------------------------------------------------------------*/
+static int SyroComp_EncodeBlock(uint8_t *map_buffer, const uint8_t *psrc, uint8_t *pdest,
+	int num_of_thissample, int quality, Endian sample_endian)
+{
+	ReadSample rp;
+	int BitBase[4];
+	int i;
+	int prlen;
+	int type;
+	int32_t dat;
+
+	rp.bitlen_eff = quality;
+	rp.SampleEndian = sample_endian;
+	rp.ptr = psrc;
+	rp.NumOfSample = (uint32_t)num_of_thissample;
+	rp.sum = 0;
+	
+	prlen = SyroComp_MakeMap(map_buffer, &rp, BitBase, &type);
+	
+	if (prlen && (prlen < (num_of_thissample*quality))) {
+		/*----- compressible ------*/
+		*pdest++ = (uint8_t)(num_of_thissample>>8) | (uint8_t)(type<<5);
+		*pdest++ = (uint8_t)num_of_thissample;
+		prlen = SyroComp_CompBlock(map_buffer, pdest+4, &rp, BitBase, type);
+		*pdest++ = (uint8_t)(prlen>>8);
+		*pdest++ = (uint8_t)prlen;			
+		*pdest++ = (uint8_t)(rp.sum >> 8);
+		*pdest++ = (uint8_t)rp.sum;
+	} else {
+		/*----- copy without compression ------*/
+		*pdest++ = (uint8_t)(0xe0 | (num_of_thissample>>8));
+		*pdest++ = (uint8_t)num_of_thissample;
+		*pdest++ = (uint8_t)(num_of_thissample>>7);
+		*pdest++ = (uint8_t)(num_of_thissample<<1);
+		{
+			WriteBit wb;
+			wb.ptr = (pdest+2);
+			wb.BitCount = 0;
+			wb.ByteCount = 0;
+			
+			for (i=0; i<num_of_thissample; i++) {
+				dat = SyroComp_GetPcm(&rp);
+				SyroComp_WriteBit(&wb, (uint32_t)dat, quality);
+			}
+			if (wb.BitCount) {
+				SyroComp_WriteBit(&wb, 0, (8-wb.BitCount));
+			}
+			*pdest++ = (uint8_t)(rp.sum >> 8);
+			*pdest++ = (uint8_t)rp.sum;
+
+			prlen = wb.ByteCount;
+		}
+	}
+	
+	return (prlen+6);
+}
+
+/*-----------------------------------------------------------------------------
+	Compress single block, from the cache if it is there
+	 ret : byte size written to pdest.
+ -----------------------------------------------------------------------------*/
+static int SyroComp_CompSingleBlock(uint8_t *map_buffer, const uint8_t *psrc, uint8_t *pdest,
+	int num_of_thissample, int quality, Endian sample_endian)
+{
+	int len;
+	
+	if (comp_cache) {
+		len = comp_cache->Load(comp_cache->param, psrc, num_of_thissample, quality,
+			sample_endian, pdest);
+		if (len) {
+			return len;
+		}
+	}
+	
+	len = SyroComp_EncodeBlock(map_buffer, psrc, pdest, num_of_thissample, quality,
+		sample_endian);
+	
+	if (comp_cache) {
+		comp_cache->Store(comp_cache->param, psrc, num_of_thissample, quality,
+			sample_endian, pdest, len);
+	}
+	
+	return len;
+}
+
+/*======================================================================
+	Set Cache
+	  pcache = callbacks to load and store compressed blocks, and the
+	  sizes GetCompSize works out, called from any thread. NULL to
+	  compress and size every block.
+ ======================================================================*/
+void SyroComp_SetCache(const SyroCompCache *pcache)
+{
+	comp_cache = pcache;
+}
+
 /*======================================================================
 	Syro Get Sample
  ======================================================================*/
@@ -465,7 +580,7 @@ uint32_t SyroComp_GetCompSize(const uint8_t *psrc, uint32_t num_of_sample,
 	ReadSample rp;
 	uint32_t num_of_thissample;
 	uint32_t allsize_byte;
-	uint32_t thissize_bit;
+	uint32_t thissize_bit, thissize_byte;
 	uint8_t *map_buffer;
 	
 	map_buffer = malloc(VOLCASAMPLE_COMP_BLOCK_LEN);
@@ -485,15 +600,31 @@ uint32_t SyroComp_GetCompSize(const uint8_t *psrc, uint32_t num_of_sample,
 			num_of_thissample = num_of_sample;
 		}
 		rp.NumOfSample = num_of_thissample;
-		thissize_bit = (uint32_t)SyroComp_MakeMap(map_buffer, &rp, NULL, NULL);
 		
-		if ((!thissize_bit) || (thissize_bit >= (quality * num_of_thissample))) {
-			//----- use liner ----
-			thissize_bit = (quality * num_of_thissample);
+		//----- size kept by the cache, the map is only made if missing -----
+		thissize_byte = 0;
+		if (comp_cache) {
+			thissize_byte = (uint32_t)comp_cache->LoadSize(comp_cache->param, rp.ptr,
+				(int)num_of_thissample, (int)quality, sample_endian);
 		}
-		allsize_byte += ((thissize_bit + 7) / 8);
 		
-		allsize_byte += 6;		//--- for Header & CRC -----
+		if (!thissize_byte) {
+			thissize_bit = (uint32_t)SyroComp_MakeMap(map_buffer, &rp, NULL, NULL);
+			
+			if ((!thissize_bit) || (thissize_bit >= (quality * num_of_thissample))) {
+				//----- use liner ----
+				thissize_bit = (quality * num_of_thissample);
+			}
+			thissize_byte = ((thissize_bit + 7) / 8);
+			
+			thissize_byte += 6;		//--- for Header & CRC -----
+			
+			if (comp_cache) {
+				comp_cache->StoreSize(comp_cache->param, rp.ptr, (int)num_of_thissample,
+					(int)quality, sample_endian, (int)thissize_byte);
+			}
+		}
+		allsize_byte += thissize_byte;
 		
 		rp.ptr += (num_of_thissample * 2);
 		num_of_sample -= num_of_thissample;
@@ -508,7 +639,6 @@ uint32_t SyroComp_GetCompSize(const uint8_t *psrc, uint32_t num_of_sample,
 	return allsize_byte;
 }
 
-
 /*=============================================================================
 	Compress Block
 	  psrc = pointer to source sample.
@@ -520,14 +650,8 @@ uint32_t SyroComp_GetCompSize(const uint8_t *psrc, uint32_t num_of_sample,
 uint32_t SyroComp_Comp(const uint8_t *psrc, uint8_t *pdest, int num_of_sample, 
 	int quality, Endian sample_endian) 
 {
-	ReadSample rp;
-	int BitBase[4];
-	int i;
-	int srccount, count;
+	int count, len;
 	int num_of_thissample;
-	int prlen;
-	int type;
-	int32_t dat;
 	uint8_t *map_buffer;
 
 	map_buffer = malloc(VOLCASAMPLE_COMP_BLOCK_LEN);
@@ -535,12 +659,7 @@ uint32_t SyroComp_Comp(const uint8_t *psrc, uint8_t *pdest, int num_of_sample,
 		return 0;
 	}	
 
-	rp.bitlen_eff = quality;
-	rp.SampleEndian = sample_endian;
-	rp.ptr = psrc;
-
 	count = 0;
-	srccount = 0;
 	
 	for (;;) {
 		/*------- decide block length ------*/
@@ -548,51 +667,13 @@ uint32_t SyroComp_Comp(const uint8_t *psrc, uint8_t *pdest, int num_of_sample,
 		if (num_of_thissample > num_of_sample) {
 			num_of_thissample = num_of_sample;
 		}
-		rp.NumOfSample = (uint32_t)num_of_thissample;
-		rp.sum = 0;
-		
-		prlen = SyroComp_MakeMap(map_buffer, &rp, BitBase, &type);
+		len = SyroComp_CompSingleBlock(map_buffer, psrc, pdest, num_of_thissample,
+			quality, sample_endian);
 		
-		if (prlen && (prlen < (num_of_thissample*quality))) {
-			/*----- compressible ------*/
-			*pdest++ = (uint8_t)(num_of_thissample>>8) | (uint8_t)(type<<5);
-			*pdest++ = (uint8_t)num_of_thissample;
-			prlen = SyroComp_CompBlock(map_buffer, pdest+4, &rp, BitBase, type);
-			*pdest++ = (uint8_t)(prlen>>8);
-			*pdest++ = (uint8_t)prlen;			
-			*pdest++ = (uint8_t)(rp.sum >> 8);
-			*pdest++ = (uint8_t)rp.sum;
-			count += (prlen+6);
-			pdest += prlen;
-		} else {
-			/*----- copy without compression ------*/
-			*pdest++ = (uint8_t)(0xe0 | (num_of_thissample>>8));
-			*pdest++ = (uint8_t)num_of_thissample;
-			*pdest++ = (uint8_t)(num_of_thissample>>7);
-			*pdest++ = (uint8_t)(num_of_thissample<<1);
-			{
-				WriteBit wb;
-				wb.ptr = (pdest+2);
-				wb.BitCount = 0;
-				wb.ByteCount = 0;
-				
-				for (i=0; i<num_of_thissample; i++) {
-					dat = SyroComp_GetPcm(&rp);
-					SyroComp_WriteBit(&wb, (uint32_t)dat, quality);
-				}
-				if (wb.BitCount) {
-					SyroComp_WriteBit(&wb, 0, (8-wb.BitCount));
-				}
-				*pdest++ = (uint8_t)(rp.sum >> 8);
-				*pdest++ = (uint8_t)rp.sum;
-
-				prlen = wb.ByteCount;
-				pdest += prlen;
-				count += (prlen+6);
-			}
-		}
+		count += len;
+		pdest += len;
+		psrc += (num_of_thissample * 2);
 		num_of_sample -= num_of_thissample;
-		srccount += num_of_thissample;
 		if (!num_of_sample) {
 			break;
 		}
@@ -603,7 +684,96 @@ uint32_t SyroComp_Comp(const uint8_t *psrc, uint8_t *pdest, int num_of_sample,
 	return (uint32_t)count;
 }
 
+/*-----------------------------------------------------------------------------
+	Compress blocks in parallel (thread job)
+ -----------------------------------------------------------------------------*/
+typedef struct {
+	const uint8_t *psrc;
+	uint8_t *scratch;
+	int len[COMP_PARALLEL_BATCH];
+	int FirstBlock;
+	int num_of_sample;
+	int quality;
+	Endian SampleEndian;
+} CompParallel;
 
+static void SyroComp_CompParallelJob(void *param, int index)
+{
+	CompParallel *pcp;
+	uint8_t map_buffer[VOLCASAMPLE_COMP_BLOCK_LEN];
+	int block, num_of_thissample;
+	
+	pcp = (CompParallel *)param;
+	
+	block = pcp->FirstBlock + index;
+	num_of_thissample = pcp->num_of_sample - (block * VOLCASAMPLE_COMP_BLOCK_LEN);
+	if (num_of_thissample > VOLCASAMPLE_COMP_BLOCK_LEN) {
+		num_of_thissample = VOLCASAMPLE_COMP_BLOCK_LEN;
+	}
+	
+	pcp->len[index] = SyroComp_CompSingleBlock(
+		map_buffer,
+		(pcp->psrc + (block * VOLCASAMPLE_COMP_BLOCK_LEN * 2)),
+		(pcp->scratch + (index * VOLCASAMPLE_COMP_BLOCK_SIZE_MAX)),
+		num_of_thissample,
+		pcp->quality,
+		pcp->SampleEndian
+	);
+}
 
+/*=============================================================================
+	Compress Block (parallel)
+	  same as SyroComp_Comp, blocks are compressed to scratch memory on
+	  num_of_thread threads, and then packed into pdest in order.
+ =============================================================================*/
+uint32_t SyroComp_CompParallel(const uint8_t *psrc, uint8_t *pdest, int num_of_sample, 
+	int quality, Endian sample_endian, int num_of_thread) 
+{
+	CompParallel *pcp;
+	int i, count;
+	int num_of_block, num_of_thisblock;
 
-
+	if ((num_of_thread <= 1) || (num_of_sample <= VOLCASAMPLE_COMP_BLOCK_LEN)) {
+		return SyroComp_Comp(psrc, pdest, num_of_sample, quality, sample_endian);
+	}
+	
+	pcp = malloc(sizeof(CompParallel));
+	if (!pcp) {
+		return 0;
+	}
+	pcp->scratch = malloc(COMP_PARALLEL_BATCH * VOLCASAMPLE_COMP_BLOCK_SIZE_MAX);
+	if (!pcp->scratch) {
+		free(pcp);
+		return 0;
+	}
+	
+	pcp->psrc = psrc;
+	pcp->num_of_sample = num_of_sample;
+	pcp->quality = quality;
+	pcp->SampleEndian = sample_endian;
+	
+	num_of_block = (num_of_sample + VOLCASAMPLE_COMP_BLOCK_LEN - 1) / VOLCASAMPLE_COMP_BLOCK_LEN;
+	count = 0;
+	
+	for (pcp->FirstBlock=0; pcp->FirstBlock<num_of_block; pcp->FirstBlock+=COMP_PARALLEL_BATCH) {
+		num_of_thisblock = num_of_block - pcp->FirstBlock;
+		if (num_of_thisblock > COMP_PARALLEL_BATCH) {
+			num_of_thisblock = COMP_PARALLEL_BATCH;
+		}
+		
+		/*------- 1st pass, compress each block ------*/
+		SyroThread_Run(SyroComp_CompParallelJob, pcp, num_of_thisblock, num_of_thread);
+		
+		/*------- 2nd pass, pack them in order ------*/
+		for (i=0; i<num_of_thisblock; i++) {
+			memcpy(pdest, (pcp->scratch + (i * VOLCASAMPLE_COMP_BLOCK_SIZE_MAX)), pcp->len[i]);
+			pdest += pcp->len[i];
+			count += pcp->len[i];
+		}
+	}
+	
+	free(pcp->scratch);
+	free(pcp);
+	
+	return (uint32_t)count;
+}
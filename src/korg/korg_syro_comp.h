@@ -5,17 +5,40 @@
 
 #define VOLCASAMPLE_COMP_BLOCK_LEN	0x800
 
+//--- max byte size of a compressed block (stored without compression) ---
+#define VOLCASAMPLE_COMP_BLOCK_SIZE_MAX	(6 + (VOLCASAMPLE_COMP_BLOCK_LEN * 2))
+
+//--- compressed block cache, keyed by the block samples, quality and endian ---
+//--- Load returns the byte size of the block (0 if missing), Store is only called from Start ---
+//--- LoadSize/StoreSize keep the byte size alone, for GetCompSize, nothing is encoded ---
+typedef struct {
+	void *param;
+	int (*Load)(void *param, const uint8_t *psrc, int num_of_sample, int quality,
+		Endian sample_endian, uint8_t *pdest);
+	void (*Store)(void *param, const uint8_t *psrc, int num_of_sample, int quality,
+		Endian sample_endian, const uint8_t *pcomp, int len);
+	int (*LoadSize)(void *param, const uint8_t *psrc, int num_of_sample, int quality,
+		Endian sample_endian);
+	void (*StoreSize)(void *param, const uint8_t *psrc, int num_of_sample, int quality,
+		Endian sample_endian, int len);
+} SyroCompCache;
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+void SyroComp_SetCache(const SyroCompCache *pcache);
+
 uint32_t SyroComp_GetCompSize(const uint8_t *psrc, uint32_t num_of_sample,
 	uint32_t quality, Endian sample_endian);
 
 uint32_t SyroComp_Comp(const uint8_t *psrc, uint8_t *pdest, int num_of_sample, 
 	int quality, Endian sample_endian);
 
+uint32_t SyroComp_CompParallel(const uint8_t *psrc, uint8_t *pdest, int num_of_sample, 
+	int quality, Endian sample_endian, int num_of_thread);
+
 #ifdef __cplusplus
 }
 #endif
@@ -60,8 +60,43 @@ static const uint16_t crc16_table[] = {
 	0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0 
 };
 
-static const int16_t sin_table[] = {
-	0, 	23169, 	32767, 	23169, 	0, 	-23169, -32767, -23169
+/*----------------------------------------------------------------
+	One QAM cycle for every symbol, [block][dat][sample].
+	sin(phase) scaled by vol/24, where phase starts at (dat>>1)*90deg
+	and vol is 16 or 4 by (dat&1). In the block case the sin is
+	shaped as 32767-((32767-sin)^2/32767).
+ ----------------------------------------------------------------*/
+static const int16_t wave_table[2][8][KORGSYRO_QAM_CYCLE] = {
+	{	// gap, mark
+		{     0,  3861,  5461,  3861,     0, -3861, -5461, -3861 },
+		{     0, 15446, 21844, 15446,     0,-15446,-21844,-15446 },
+		{  5461,  3861,     0, -3861, -5461, -3861,     0,  3861 },
+		{ 21844, 15446,     0,-15446,-21844,-15446,     0, 15446 },
+		{     0, -3861, -5461, -3861,     0,  3861,  5461,  3861 },
+		{     0,-15446,-21844,-15446,     0, 15446, 21844, 15446 },
+		{ -5461, -3861,     0,  3861,  5461,  3861,     0, -3861 },
+		{-21844,-15446,     0, 15446, 21844, 15446,     0,-15446 }
+	},
+	{	// data (block)
+		{     0,  4992,  5461,  4992,     0, -4992, -5461, -4992 },
+		{     0, 19970, 21844, 19970,     0,-19970,-21844,-19970 },
+		{  5461,  4992,     0, -4992, -5461, -4992,     0,  4992 },
+		{ 21844, 19970,     0,-19970,-21844,-19970,     0, 19970 },
+		{     0, -4992, -5461, -4992,     0,  4992,  5461,  4992 },
+		{     0,-19970,-21844,-19970,     0, 19970, 21844, 19970 },
+		{ -5461, -4992,     0,  4992,  5461,  4992,     0, -4992 },
+		{-21844,-19970,     0, 19970, 21844, 19970,     0,-19970 }
+	}
+};
+
+/*----------------------------------------------------------------
+	Smooth the edge from the last cycle, [LastPhase][phase].
+ ----------------------------------------------------------------*/
+static const bool smooth_table[4][4] = {
+	{ false, true, false, false },
+	{ false, false, true, true },
+	{ false, false, false, true },
+	{ true, true, false, false }
 };
 
 /*----------------------------------------------------------------
@@ -159,71 +194,36 @@ void SyroFunc_SetTxSize(uint8_t *ptr, uint32_t size, int num_of_bytes)
 	}
 }
 
-/*----------------------------------------------------------------
-	Get sin value 
- ----------------------------------------------------------------*/
-static int16_t SyroFunc_GetSinValue(int phase, bool bData)
-{
-	int32_t ret;
-	
-	ret = sin_table[phase];
-	
-	if (bData) {
-		if (ret > 0) {
-			ret = 32767 - ret;
-			ret = ((ret * ret) / 32767);
-			ret = 32767 - ret;
-		} else if (ret < 0) {
-			ret += 32767;
-			ret = ((ret * ret) / 32767);
-			ret -= 32767;
-		}
-	}
-
-	return (int16_t)ret;
-}
-
 /*-----------------------------------------------------------------------
 	Generate Single Sycle
  -----------------------------------------------------------------------*/
 void SyroFunc_GenerateSingleCycle(SyroChannel *psc, int write_page, uint8_t dat, bool block)
 {
-	int i, phase_org, phase;
+	int phase_org;
 	int32_t dat1, dat2;
-	int vol, dlt;
+	int dlt;
 	int write_pos, write_pos_last;
+	const int16_t *pwave;
 	
 	write_pos = write_page * KORGSYRO_QAM_CYCLE;
 	write_pos_last = write_pos ? (write_pos - 1) : (KORGSYRO_NUM_OF_CYCLE_BUF - 1);
 	
 	phase_org = (dat >> 1) & 3;
-	phase = phase_org * (KORGSYRO_QAM_CYCLE / 4);
-	vol = (dat & 1);
-	vol = vol ? 16 : 4;
+	pwave = wave_table[block ? 1 : 0][dat & 7];
 	
-	for (i=0; i<KORGSYRO_QAM_CYCLE; i++) {
-		dat1 = SyroFunc_GetSinValue(phase, block);
-		dat1 = (dat1 * vol) / 24;
-		if (!i) {
-			if (phase_org != psc->LastPhase) {
-				if (((psc->LastPhase & 1) && (phase_org & 1)) ||
-					(((psc->LastPhase + 1) & 3) == phase_org))
-				{
-					dat2 = psc->CycleSample[write_pos_last];
-					dlt = dat1 - dat2;
-					dlt /= 3;
-					dat1 -= dlt;
-					dat2 += dlt;
-					psc->CycleSample[write_pos_last] = (int16_t)dat2;
-				}
-			}
-		}
-		
-		psc->CycleSample[write_pos++] = (int16_t)dat1;
-		if ((++phase) == KORGSYRO_QAM_CYCLE) {
-			phase = 0;
-		}
+	dat1 = pwave[0];
+	if (smooth_table[psc->LastPhase][phase_org]) {
+		dat2 = psc->CycleSample[write_pos_last];
+		dlt = dat1 - dat2;
+		dlt /= 3;
+		dat1 -= dlt;
+		dat2 += dlt;
+		psc->CycleSample[write_pos_last] = (int16_t)dat2;
 	}
+	
+	psc->CycleSample[write_pos] = (int16_t)dat1;
+	memcpy(&psc->CycleSample[write_pos+1], (pwave+1), (KORGSYRO_QAM_CYCLE-1) * sizeof(int16_t));
+	
 	psc->LastPhase = phase_org;
 }
 
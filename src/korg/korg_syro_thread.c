@@ -0,0 +1,126 @@
+/************************************************************************
+	SYRO for volca sample
+		run independent jobs on worker threads
+ ***********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "korg_syro_type.h"
+#include "korg_syro_thread.h"
+
+#ifndef _MSC_VER
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define SYRO_THREAD_MAX		64
+
+typedef struct {
+	SyroThreadFunc func;
+	void *param;
+	int NumOfJob;
+	int NextJob;
+#ifndef _MSC_VER
+	pthread_mutex_t Lock;
+#endif
+} SyroThreadPool;
+
+/*-----------------------------------------------------------------------
+	Get number of online processors
+ -----------------------------------------------------------------------*/
+int SyroThread_GetNumOfThread(void)
+{
+#ifndef _MSC_VER
+	long num;
+	
+	num = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num < 1) {
+		return 1;
+	}
+	if (num > SYRO_THREAD_MAX) {
+		return SYRO_THREAD_MAX;
+	}
+	return (int)num;
+#else
+	return 1;
+#endif
+}
+
+#ifndef _MSC_VER
+/*-----------------------------------------------------------------------
+	Worker, take jobs until all of them are done
+ -----------------------------------------------------------------------*/
+static void *SyroThread_Worker(void *arg)
+{
+	SyroThreadPool *pool;
+	int index;
+	
+	pool = (SyroThreadPool *)arg;
+	
+	for (;;) {
+		pthread_mutex_lock(&pool->Lock);
+		index = pool->NextJob++;
+		pthread_mutex_unlock(&pool->Lock);
+		
+		if (index >= pool->NumOfJob) {
+			break;
+		}
+		pool->func(pool->param, index);
+	}
+	
+	return NULL;
+}
+#endif
+
+/*=============================================================================
+	Run Jobs
+	  func = called once for every index in 0..num_of_job-1.
+	  param = passed to func as-is.
+	  num_of_thread = number of threads to use, including the caller's.
+	  jobs must be independent, they are run in no particular order.
+ =============================================================================*/
+void SyroThread_Run(SyroThreadFunc func, void *param, int num_of_job, int num_of_thread)
+{
+	int i;
+	
+#ifndef _MSC_VER
+	SyroThreadPool pool;
+	pthread_t thread[SYRO_THREAD_MAX];
+	int num_of_started;
+	
+	if (num_of_thread > num_of_job) {
+		num_of_thread = num_of_job;
+	}
+	if (num_of_thread > SYRO_THREAD_MAX) {
+		num_of_thread = SYRO_THREAD_MAX;
+	}
+	
+	if (num_of_thread > 1) {
+		pool.func = func;
+		pool.param = param;
+		pool.NumOfJob = num_of_job;
+		pool.NextJob = 0;
+		pthread_mutex_init(&pool.Lock, NULL);
+		
+		//----- the caller is the 1st worker -----
+		num_of_started = 0;
+		for (i=1; i<num_of_thread; i++) {
+			if (pthread_create(&thread[num_of_started], NULL, SyroThread_Worker, &pool)) {
+				break;
+			}
+			num_of_started++;
+		}
+		SyroThread_Worker(&pool);
+		
+		for (i=0; i<num_of_started; i++) {
+			pthread_join(thread[i], NULL);
+		}
+		pthread_mutex_destroy(&pool.Lock);
+		return;
+	}
+#endif
+
+	for (i=0; i<num_of_job; i++) {
+		func(param, i);
+	}
+}
+
@@ -0,0 +1,22 @@
+
+#ifndef KORG_SYRO_THREAD_H__
+#define KORG_SYRO_THREAD_H__
+
+#include "korg_syro_type.h"
+
+typedef void (*SyroThreadFunc)(void *param, int index);
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+int SyroThread_GetNumOfThread(void);
+void SyroThread_Run(SyroThreadFunc func, void *param, int num_of_job, int num_of_thread);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
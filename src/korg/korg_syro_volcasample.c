@@ -7,6 +7,11 @@
 #include "korg_syro_volcasample.h"
 #include "korg_syro_func.h"
 #include "korg_syro_comp.h"
+#include "korg_syro_thread.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define NUM_OF_DATA_MAX		(VOLCASAMPLE_NUM_OF_PATTERN + VOLCASAMPLE_NUM_OF_SAMPLE)
 #define VOLCA_SAMPLE_FS		31250
@@ -25,6 +30,7 @@
 #define NUM_OF_GAP_F_CYCLE		1000
 #define NUM_OF_GAP_FOOTER_CYCLE	3000
 #define NUM_OF_GAP_3S_CYCLE		15000
+#define NUM_OF_GAP_SPLICE_CYCLE	1000	// into the header gap, where the channels are steady
 
 #define	NUM_OF_FRAME__GAP_HEADER	(NUM_OF_GAP_HEADER_CYCLE * KORGSYRO_QAM_CYCLE)
 #define	NUM_OF_FRAME__GAP			(NUM_OF_GAP_CYCLE * KORGSYRO_QAM_CYCLE)
@@ -104,6 +110,18 @@ typedef struct {
 	SyroChannel Channel[KORGSYRO_NUM_OF_CHANNEL];
 	int CyclePos;
 	int FrameCountInCycle;
+	
+	//---- Splice points -----
+	uint32_t FrameCount;		// frames got so far
+	uint32_t CycleCount;		// cycles made so far, 2 ahead of FrameCount
+	uint32_t SpliceFrame;		// splice point of SpliceData
+	int SpliceData;				// NumOfData for the footer, -1 if not known yet
+	
+	//---- Steady state gap output -----
+	bool PageIsGap[KORGSYRO_NUM_OF_CYCLE];
+	bool GapCached;
+	int32_t GapLpf_z[KORGSYRO_NUM_OF_CHANNEL];
+	uint8_t GapCycle[KORGSYRO_QAM_CYCLE * KORGSYRO_NUM_OF_CHANNEL * 2];
 
 	int LongGapCount;		// Debug Put
 } SyroManage;
@@ -230,6 +248,17 @@ static void SyroVolcaSample_SetupNextData(SyroManage *psm)
 	
 	psm->TaskStatus = TaskStatus_Gap;
 	psm->TaskCount = NUM_OF_GAP_HEADER_CYCLE;
+	psm->SpliceData = -1;
+}
+
+/*-----------------------------------------------------------------------
+	Setup Footer
+ -----------------------------------------------------------------------*/
+static void SyroVolcaSample_SetupFooter(SyroManage *psm)
+{
+	psm->TaskStatus = TaskStatus_Gap_Footer;
+	psm->TaskCount = NUM_OF_GAP_FOOTER_CYCLE;
+	psm->SpliceData = -1;
 }
 
 
@@ -304,6 +333,29 @@ static bool SyroVolcaSample_MakeData(SyroManage *psm, int write_page)
 	return data_end;
 }
 
+/*-----------------------------------------------------------------------
+	Make Gap, and mark the page if it is the plain gap cycle.
+	 the cycle is plain if no edge was smoothed (LastPhase is 0).
+ -----------------------------------------------------------------------*/
+static void SyroVolcaSample_MakeGap(SyroManage *psm, int write_page)
+{
+	bool plain;
+	
+	plain = ((!psm->Channel[0].LastPhase) && (!psm->Channel[1].LastPhase));
+	
+	//----- the page already holds the plain gap cycle -----
+	if (plain && psm->PageIsGap[write_page]) {
+		return;
+	}
+	
+	SyroFunc_MakeGap(psm->Channel, write_page);
+	
+	psm->PageIsGap[write_page] = plain;
+	if (!plain) {
+		psm->PageIsGap[write_page ^ 1] = false;
+	}
+}
+
 /*-----------------------------------------------------------------------
 	Nake Next Cycle
  -----------------------------------------------------------------------*/
@@ -314,9 +366,23 @@ static void SyroVolcaSample_CycleHandler(SyroManage *psm)
 	
 	write_page = (psm->CyclePos / KORGSYRO_QAM_CYCLE) ^ 1;
 	
+	if ((psm->TaskStatus != TaskStatus_Gap) && (psm->TaskStatus != TaskStatus_Gap_Footer)) {
+		//----- the edge of the last page may be smoothed -----
+		psm->PageIsGap[write_page] = false;
+		psm->PageIsGap[write_page ^ 1] = false;
+	}
+	
+	//----- 1st cycle of the header gap (or footer), the cycle made now is output as frame CycleCount*8 -----
+	if ((psm->SpliceData < 0) && 
+		((psm->TaskStatus == TaskStatus_Gap) || (psm->TaskStatus == TaskStatus_Gap_Footer)))
+	{
+		psm->SpliceData = (psm->TaskStatus == TaskStatus_Gap) ? psm->CurData : psm->NumOfData;
+		psm->SpliceFrame = (psm->CycleCount + NUM_OF_GAP_SPLICE_CYCLE) * KORGSYRO_QAM_CYCLE;
+	}
+	
 	switch (psm->TaskStatus) {
 		case TaskStatus_Gap:
-			SyroFunc_MakeGap(psm->Channel, write_page);
+			SyroVolcaSample_MakeGap(psm, write_page);
 			if (!(--psm->TaskCount)) {
 				psm->TaskStatus = TaskStatus_StartMark;
 				SyroVolcaSample_SetupBlock(psm);
@@ -395,15 +461,14 @@ static void SyroVolcaSample_CycleHandler(SyroManage *psm)
 					if (psm->CurData < psm->NumOfData) {
 						SyroVolcaSample_SetupNextData(psm);
 					} else {
-						psm->TaskStatus = TaskStatus_Gap_Footer;
-						psm->TaskCount = NUM_OF_GAP_FOOTER_CYCLE;
+						SyroVolcaSample_SetupFooter(psm);
 					}
 				}
 			}
 			break;
 		
 		case TaskStatus_Gap_Footer:
-			SyroFunc_MakeGap(psm->Channel, write_page);
+			SyroVolcaSample_MakeGap(psm, write_page);
 			if (!(--psm->TaskCount)) {
 				psm->TaskStatus = TaskStatus_End;
 			}
@@ -414,6 +479,7 @@ static void SyroVolcaSample_CycleHandler(SyroManage *psm)
 	}
 	
 	psm->FrameCountInCycle += KORGSYRO_QAM_CYCLE;
+	psm->CycleCount++;
 }
 
 /*-----------------------------------------------------------------------
@@ -434,117 +500,206 @@ static int16_t SyroVolcaSample_GetChSample(SyroManage *psm, int ch)
 	return (int16_t)dat;
 }
 
+#ifdef __SSE2__
+/*-----------------------------------------------------------------------
+	Divide by 8, round toward zero (same as C division)
+ -----------------------------------------------------------------------*/
+static inline __m128i SyroVolcaSample_Div8_SSE2(__m128i dat)
+{
+	__m128i bias;
+	
+	bias = _mm_and_si128(_mm_srai_epi32(dat, 31), _mm_set1_epi32(7));
+	return _mm_srai_epi32(_mm_add_epi32(dat, bias), 3);
+}
+
+/*-----------------------------------------------------------------------
+	LPF & pack a whole cycle of both channels (SSE2)
+	 pDest : 8 frames, 16bit stereo, little endian.
+	 (dat*0xe000 + z*0x2000)/0x10000 is computed as (dat*7 + z)/8,
+	 the result is the same as SyroVolcaSample_GetChSample.
+ -----------------------------------------------------------------------*/
+static void SyroVolcaSample_PutCycle_SSE2(SyroManage *psm, uint8_t *pDest)
+{
+	__m128i left, right, lr, dat, dat7, z, y1st, y2nd;
+	__m128i out[4];
+	int i;
+	
+	left = _mm_loadu_si128((const __m128i *)&psm->Channel[0].CycleSample[psm->CyclePos]);
+	right = _mm_loadu_si128((const __m128i *)&psm->Channel[1].CycleSample[psm->CyclePos]);
+	
+	z = _mm_setr_epi32(psm->Channel[0].Lpf_z, psm->Channel[1].Lpf_z, 0, 0);
+	
+	for (i=0; i<4; i++) {
+		//----- 2 frames (L,R,L,R) as int32 -----
+		lr = (i < 2) ? _mm_unpacklo_epi16(left, right) : _mm_unpackhi_epi16(left, right);
+		dat = (i & 1) ? _mm_unpackhi_epi16(lr, lr) : _mm_unpacklo_epi16(lr, lr);
+		dat = _mm_srai_epi32(dat, 16);
+		dat7 = _mm_sub_epi32(_mm_slli_epi32(dat, 3), dat);
+		
+		//----- 1st frame in lane 0,1, 2nd frame in lane 2,3 -----
+		y1st = SyroVolcaSample_Div8_SSE2(_mm_add_epi32(dat7, z));
+		y2nd = SyroVolcaSample_Div8_SSE2(_mm_add_epi32(dat7, _mm_slli_si128(y1st, 8)));
+		
+		z = _mm_unpackhi_epi64(y2nd, y2nd);
+		out[i] = _mm_unpacklo_epi64(y1st, z);
+	}
+	
+	_mm_storeu_si128((__m128i *)pDest, _mm_packs_epi32(out[0], out[1]));
+	_mm_storeu_si128((__m128i *)(pDest + 16), _mm_packs_epi32(out[2], out[3]));
+	
+	psm->Channel[0].Lpf_z = _mm_cvtsi128_si32(z);
+	psm->Channel[1].Lpf_z = _mm_cvtsi128_si32(_mm_srli_si128(z, 4));
+}
+#endif
+
+/*-----------------------------------------------------------------------
+	LPF & pack frames of both channels
+	 pDest : len frames, 16bit stereo, little endian.
+ -----------------------------------------------------------------------*/
+static void SyroVolcaSample_PutFrames(SyroManage *psm, uint8_t *pDest, uint32_t len)
+{
+	int16_t left, right;
+	int32_t lpf_z[KORGSYRO_NUM_OF_CHANNEL];
+	uint8_t *pCycle;
+	bool gap;
+	
+	pCycle = pDest;
+	gap = ((len == KORGSYRO_QAM_CYCLE) && psm->PageIsGap[psm->CyclePos / KORGSYRO_QAM_CYCLE]);
+	
+	if (gap) {
+		lpf_z[0] = psm->Channel[0].Lpf_z;
+		lpf_z[1] = psm->Channel[1].Lpf_z;
+		
+		//----- LPF is in steady state, the output is the same as last gap -----
+		if (psm->GapCached && (lpf_z[0] == psm->GapLpf_z[0]) && (lpf_z[1] == psm->GapLpf_z[1])) {
+			memcpy(pDest, psm->GapCycle, sizeof(psm->GapCycle));
+			psm->CyclePos += KORGSYRO_QAM_CYCLE;
+			return;
+		}
+	}
+	
+#ifdef __SSE2__
+	if (len == KORGSYRO_QAM_CYCLE) {
+		SyroVolcaSample_PutCycle_SSE2(psm, pDest);
+		psm->CyclePos += KORGSYRO_QAM_CYCLE;
+		len = 0;
+	}
+#endif
+
+	while (len--) {
+		left = SyroVolcaSample_GetChSample(psm, 0);
+		right = SyroVolcaSample_GetChSample(psm, 1);
+		*pDest++ = (uint8_t)left;
+		*pDest++ = (uint8_t)(left >> 8);
+		*pDest++ = (uint8_t)right;
+		*pDest++ = (uint8_t)(right >> 8);
+		psm->CyclePos++;
+	}
+	
+	//----- reached steady state, keep this cycle -----
+	if (gap && (psm->Channel[0].Lpf_z == lpf_z[0]) && (psm->Channel[1].Lpf_z == lpf_z[1])) {
+		memcpy(psm->GapCycle, pCycle, sizeof(psm->GapCycle));
+		psm->GapLpf_z[0] = lpf_z[0];
+		psm->GapLpf_z[1] = lpf_z[1];
+		psm->GapCached = true;
+	}
+}
+
 /*-----------------------------------------------------------------------
 	Get Frame Size (union)
+	 num_of_erase : number of erase gaps, erase_frame long each, which
+	                replace the gap before a block.
+	 psplit : NULL, or gets the frames of each part.
  -----------------------------------------------------------------------*/
-static uint32_t SyroVolcaSample_GetFrameSize(int num_of_block)
+static uint32_t SyroVolcaSample_GetFrameSize(int num_of_block, uint32_t num_of_erase,
+	uint32_t erase_frame, SyroFrameSplit *psplit)
 {
-	uint32_t size;
+	SyroFrameSplit split;
 	
-	size = NUM_OF_FRAME__GAP_HEADER;
-	size += NUM_OF_FRAME__HEADER;
+	if (!psplit) {
+		psplit = &split;
+	}
 	
-	size += (NUM_OF_FRAME__GAP + NUM_OF_FRAME__BLOCK) * num_of_block;
+	psplit->Gap = NUM_OF_FRAME__GAP_HEADER;
+	psplit->Header = NUM_OF_FRAME__HEADER;
+	psplit->Block = (NUM_OF_FRAME__GAP + NUM_OF_FRAME__BLOCK) * num_of_block;
+	psplit->Erase = (erase_frame - NUM_OF_FRAME__GAP) * num_of_erase;
 	
-	return size;
+	return (psplit->Gap + psplit->Header + psplit->Block + psplit->Erase);
 }
 
 /*-----------------------------------------------------------------------
 	Get Frame Size (Pattern)
  -----------------------------------------------------------------------*/
-static uint32_t SyroVolcaSample_GetFrameSize_Pattern(void)
+static uint32_t SyroVolcaSample_GetFrameSize_Pattern(SyroFrameSplit *psplit)
 {
-	return SyroVolcaSample_GetFrameSize((VOLCASAMPLE_PATTERN_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	return SyroVolcaSample_GetFrameSize((VOLCASAMPLE_PATTERN_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE,
+		0, NUM_OF_FRAME__GAP, psplit);
 }
 
 /*-----------------------------------------------------------------------
 	Get Frame Size (Sample)
  -----------------------------------------------------------------------*/
-static uint32_t SyroVolcaSample_GetFrameSize_Sample(uint32_t byte_size)
+static uint32_t SyroVolcaSample_GetFrameSize_Sample(uint32_t byte_size, SyroFrameSplit *psplit)
 {
-	uint32_t size;
 	uint32_t num_of_block;
+	uint32_t num_of_erase;
 	
 	num_of_block = (byte_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-	size = SyroVolcaSample_GetFrameSize(num_of_block);
-	
-	num_of_block = (byte_size + SUBSECTOR_SIZE - 3) / (SUBSECTOR_SIZE - 2);
-	size += (NUM_OF_FRAME__GAP_F - NUM_OF_FRAME__GAP) * num_of_block;
+	num_of_erase = (byte_size + SUBSECTOR_SIZE - 3) / (SUBSECTOR_SIZE - 2);
 	
-	return size;
+	return SyroVolcaSample_GetFrameSize(num_of_block, num_of_erase, NUM_OF_FRAME__GAP_F, psplit);
 }
 
 /*-----------------------------------------------------------------------
 	Get Frame Size (Sample, Compress)
+	 comp_size : byte size of compressed data.
  -----------------------------------------------------------------------*/
-static uint32_t SyroVolcaSample_GetFrameSize_Sample_Comp(SyroData *pdata)
+static uint32_t SyroVolcaSample_GetFrameSize_Sample_Comp(SyroData *pdata, uint32_t comp_size,
+	SyroFrameSplit *psplit)
 {
-	uint32_t size, comp_size;
 	uint32_t num_of_block;
-	
-	comp_size = SyroComp_GetCompSize(
-		pdata->pData, 
-		(pdata->Size / 2), 
-		pdata->Quality,
-		pdata->SampleEndian
-	);
+	uint32_t num_of_erase;
 	
 	//----- get frame size from compressed size.
 	num_of_block = (comp_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-	size = SyroVolcaSample_GetFrameSize(num_of_block);
 	
 	//----- get gap size from original size.
-	num_of_block = (pdata->Size + SUBSECTOR_SIZE - 3) / (SUBSECTOR_SIZE - 2);
-	size += (NUM_OF_FRAME__GAP_F - NUM_OF_FRAME__GAP) * num_of_block;
+	num_of_erase = (pdata->Size + SUBSECTOR_SIZE - 3) / (SUBSECTOR_SIZE - 2);
 	
-	return size;
+	return SyroVolcaSample_GetFrameSize(num_of_block, num_of_erase, NUM_OF_FRAME__GAP_F, psplit);
 }
 
 /*-----------------------------------------------------------------------
 	Get Frame Size (All)
  -----------------------------------------------------------------------*/
-static uint32_t SyroVolcaSample_GetFrameSize_All(uint32_t byte_size)
+static uint32_t SyroVolcaSample_GetFrameSize_All(uint32_t byte_size, SyroFrameSplit *psplit)
 {
-	uint32_t size;
 	uint32_t num_of_block;
+	uint32_t num_of_erase;
 	
 	num_of_block = (byte_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-	size = SyroVolcaSample_GetFrameSize(num_of_block);
-	
-	num_of_block = (num_of_block + BLOCK_PER_SECTOR - 1) / BLOCK_PER_SECTOR;
-	size += (NUM_OF_FRAME__GAP_3S - NUM_OF_FRAME__GAP) * num_of_block;
+	num_of_erase = (num_of_block + BLOCK_PER_SECTOR - 1) / BLOCK_PER_SECTOR;
 	
-	return size;
+	return SyroVolcaSample_GetFrameSize(num_of_block, num_of_erase, NUM_OF_FRAME__GAP_3S, psplit);
 }
 
 /*-----------------------------------------------------------------------
 	Get Frame Size (All, Comp)
+	 comp_size : byte size of compressed data, including ALL_INFO_SIZE.
  -----------------------------------------------------------------------*/
-static uint32_t SyroVolcaSample_GetFrameSize_AllComp(SyroData *pdata)
+static uint32_t SyroVolcaSample_GetFrameSize_AllComp(SyroData *pdata, uint32_t comp_size,
+	SyroFrameSplit *psplit)
 {
-	uint32_t size, comp_size;
 	uint32_t num_of_block;
+	uint32_t num_of_erase;
 	
-	if (pdata->Size == ALL_INFO_SIZE) {
-		return SyroVolcaSample_GetFrameSize_All(pdata->Size);
-	}
-	
-	comp_size = SyroComp_GetCompSize(
-		(pdata->pData + ALL_INFO_SIZE),  
-		((pdata->Size - ALL_INFO_SIZE) / 2), 
-		pdata->Quality,
-		LittleEndian
-	);
-
-	comp_size += ALL_INFO_SIZE; 
 	num_of_block = (comp_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-	size = SyroVolcaSample_GetFrameSize(num_of_block);
 	
-	num_of_block = (pdata->Size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-	num_of_block = (num_of_block + BLOCK_PER_SECTOR - 1) / BLOCK_PER_SECTOR;
-	size += (NUM_OF_FRAME__GAP_3S - NUM_OF_FRAME__GAP) * num_of_block;
+	num_of_erase = (pdata->Size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	num_of_erase = (num_of_erase + BLOCK_PER_SECTOR - 1) / BLOCK_PER_SECTOR;
 	
-	return size;
+	return SyroVolcaSample_GetFrameSize(num_of_block, num_of_erase, NUM_OF_FRAME__GAP_3S, psplit);
 }
 
 /*-----------------------------------------------------------------------
@@ -566,6 +721,132 @@ static void SyroVolcaSample_FreeCompressMemory(SyroManage *psm)
 	}
 }
 
+/*-----------------------------------------------------------------------
+	Compress single data
+	 num_of_thread : >1 to compress the blocks of this data in parallel.
+	 ret : false if memory is not enough.
+ -----------------------------------------------------------------------*/
+static bool SyroVolcaSample_CompSingle(SyroManageSingle *psms, int num_of_thread)
+{
+	uint32_t comp_org_size, comp_dest_size, comp_ofs, comp_size;
+	uint32_t num_of_block;
+	uint8_t *comp_src_adr, *shrunk_buf;
+	Endian comp_endian;
+	
+	switch (psms->Data.DataType) {
+		case DataType_Sample_Compress:
+			comp_ofs = 0;
+			comp_src_adr = psms->Data.pData;
+			comp_org_size = (psms->Data.Size / 2);
+			comp_endian = psms->Data.SampleEndian;
+			break;
+		
+		case DataType_Sample_AllCompress:
+			comp_ofs = ALL_INFO_SIZE;
+			comp_src_adr = psms->Data.pData + ALL_INFO_SIZE;
+			comp_org_size = ((psms->Data.Size - ALL_INFO_SIZE) / 2);
+			comp_endian = LittleEndian;
+			break;
+		
+		default:
+			return true;
+	}
+	
+	if (!comp_org_size) {
+		return true;
+	}
+	
+	//----- compress to the max size, the actual size is known after that -----
+	num_of_block = (comp_org_size + VOLCASAMPLE_COMP_BLOCK_LEN - 1) / VOLCASAMPLE_COMP_BLOCK_LEN;
+	comp_dest_size = (num_of_block * VOLCASAMPLE_COMP_BLOCK_SIZE_MAX);
+	comp_dest_size = (comp_dest_size + BLOCK_SIZE - 1) & (~(BLOCK_SIZE-1));
+	psms->comp_size = (comp_dest_size + comp_ofs);
+	psms->comp_buf = malloc(comp_dest_size + comp_ofs);
+	if (!psms->comp_buf) {
+		return false;
+	}
+	if (comp_ofs) {
+		memcpy(psms->comp_buf, psms->Data.pData, comp_ofs);
+	}
+	comp_size = SyroComp_CompParallel(comp_src_adr, (psms->comp_buf+comp_ofs), comp_org_size, 
+		psms->Data.Quality, comp_endian, num_of_thread);
+	if (!comp_size) {
+		free(psms->comp_buf);
+		psms->comp_buf = NULL;
+		return false;
+	}
+	
+	comp_dest_size = (comp_size + BLOCK_SIZE - 1) & (~(BLOCK_SIZE-1));
+	memset((psms->comp_buf+comp_ofs+comp_size), 0, (comp_dest_size - comp_size));
+	psms->comp_size = (comp_dest_size + comp_ofs);
+	
+	//----- give back the unused memory -----
+	shrunk_buf = realloc(psms->comp_buf, psms->comp_size);
+	if (shrunk_buf) {
+		psms->comp_buf = shrunk_buf;
+	}
+	
+	return true;
+}
+
+/*-----------------------------------------------------------------------
+	Compress single data (thread job)
+ -----------------------------------------------------------------------*/
+static void SyroVolcaSample_CompJob(void *param, int index)
+{
+	SyroManageSingle *psms;
+	
+	psms = (SyroManageSingle *)param;
+	SyroVolcaSample_CompSingle(&psms[index], 1);
+}
+
+/*-----------------------------------------------------------------------
+	Compress all data
+	 ret : false if memory is not enough.
+ -----------------------------------------------------------------------*/
+static bool SyroVolcaSample_CompAll(SyroManage *psm)
+{
+	int i;
+	int num_of_thread, num_of_comp;
+	SyroManageSingle *psms;
+	
+	psms = (SyroManageSingle *)(psm+1);
+	
+	num_of_thread = 1;
+	if (psm->Flags & SYRO_FLAG_PARALLEL_COMPRESS) {
+		num_of_thread = SyroThread_GetNumOfThread();
+	}
+	
+	num_of_comp = 0;
+	for (i=0; i<psm->NumOfData; i++) {
+		if ((psms[i].Data.DataType == DataType_Sample_Compress) ||
+			(psms[i].Data.DataType == DataType_Sample_AllCompress))
+		{
+			num_of_comp++;
+		}
+	}
+	
+	//----- enough data to keep all threads busy, one job per data -----
+	if ((num_of_thread > 1) && (num_of_comp >= num_of_thread)) {
+		SyroThread_Run(SyroVolcaSample_CompJob, psms, psm->NumOfData, num_of_thread);
+		
+		for (i=0; i<psm->NumOfData; i++) {
+			if (psms[i].comp_size && (!psms[i].comp_buf)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	//----- otherwise, split each data by blocks -----
+	for (i=0; i<psm->NumOfData; i++) {
+		if (!SyroVolcaSample_CompSingle(&psms[i], num_of_thread)) {
+			return false;
+		}
+	}
+	return true;
+}
+
 /************************************************************************
 	Exteral Functions
  ***********************************************************************/
@@ -578,9 +859,6 @@ SyroStatus SyroVolcaSample_Start(SyroHandle *pHandle, SyroData *pData, int NumOf
 	int i;
 	uint32_t handle_size;
 	uint32_t frame_size;
-	uint32_t comp_org_size, comp_dest_size, comp_ofs;
-	uint8_t *comp_src_adr;
-	Endian comp_endian;
 	SyroManage *psm;
 	SyroManageSingle *psms;
 	
@@ -599,7 +877,7 @@ SyroStatus SyroVolcaSample_Start(SyroHandle *pHandle, SyroData *pData, int NumOf
 				if (pData[i].Size < ALL_INFO_SIZE) {
 					return Status_IllegalData;
 				}
-				frame_size += SyroVolcaSample_GetFrameSize_All(pData[i].Size);
+				frame_size += SyroVolcaSample_GetFrameSize_All(pData[i].Size, NULL);
 				break;
 
 			case DataType_Sample_AllCompress:
@@ -609,14 +887,17 @@ SyroStatus SyroVolcaSample_Start(SyroHandle *pHandle, SyroData *pData, int NumOf
 				if ((pData[i].Quality < 8) || (pData[i].Quality > 16)) {
 					return Status_OutOfRange_Quality;
 				}
-				frame_size += SyroVolcaSample_GetFrameSize_AllComp(&pData[i]);
+				if (pData[i].Size == ALL_INFO_SIZE) {
+					frame_size += SyroVolcaSample_GetFrameSize_All(pData[i].Size, NULL);
+				}
+				//----- others are sized after compression
 				break;
 
 			case DataType_Pattern:
 				if (pData[i].Number >= VOLCASAMPLE_NUM_OF_PATTERN) {
 					return Status_OutOfRange_Number;
 				}
-				frame_size += SyroVolcaSample_GetFrameSize_Pattern();
+				frame_size += SyroVolcaSample_GetFrameSize_Pattern(NULL);
 				break;
 
 			case DataType_Sample_Compress:
@@ -626,21 +907,21 @@ SyroStatus SyroVolcaSample_Start(SyroHandle *pHandle, SyroData *pData, int NumOf
 				if ((pData[i].Quality < 8) || (pData[i].Quality > 16)) {
 					return Status_OutOfRange_Quality;
 				}
-				frame_size += SyroVolcaSample_GetFrameSize_Sample_Comp(&pData[i]);
+				//----- sized after compression
 				break;
 
 			case DataType_Sample_Erase:
 				if (pData[i].Number >= VOLCASAMPLE_NUM_OF_SAMPLE) {
 					return Status_OutOfRange_Number;
 				}
-				frame_size += SyroVolcaSample_GetFrameSize_Sample(0);
+				frame_size += SyroVolcaSample_GetFrameSize_Sample(0, NULL);
 				break;
 
 			case DataType_Sample_Liner:
 				if (pData[i].Number >= VOLCASAMPLE_NUM_OF_SAMPLE) {
 					return Status_OutOfRange_Number;
 				}
-				frame_size += SyroVolcaSample_GetFrameSize_Sample(pData[i].Size);
+				frame_size += SyroVolcaSample_GetFrameSize_Sample(pData[i].Size, NULL);
 				break;
 			
 			default:
@@ -673,56 +954,34 @@ SyroStatus SyroVolcaSample_Start(SyroHandle *pHandle, SyroData *pData, int NumOf
 	for (i=0; i<NumOfData; i++) {
 		psms[i].Data = pData[i];
 		
-		comp_org_size = 0;
-		comp_ofs = 0;
-		comp_src_adr = 0;
-		comp_endian = LittleEndian;
-		
-		switch (pData[i].DataType) {
+		if ((pData[i].DataType == DataType_Sample_AllCompress) &&
+			(pData[i].Size == ALL_INFO_SIZE))
+		{
+			psms[i].Data.DataType = DataType_Sample_All;
+		}
+	}
+	
+	if (!SyroVolcaSample_CompAll(psm)) {
+		SyroVolcaSample_FreeCompressMemory(psm);
+		free((uint8_t *)psm);
+		return Status_NotEnoughMemory;
+	}
+	
+	for (i=0; i<NumOfData; i++) {
+		switch (psms[i].Data.DataType) {
 			case DataType_Sample_Compress:
-				comp_src_adr = pData[i].pData;
-				comp_org_size = (pData[i].Size / 2);
-				comp_endian = pData[i].SampleEndian;
+				frame_size += SyroVolcaSample_GetFrameSize_Sample_Comp(&psms[i].Data,
+					psms[i].comp_size, NULL);
 				break;
 			
 			case DataType_Sample_AllCompress:
-				if (psms[i].Data.Size == ALL_INFO_SIZE) {
-					psms[i].Data.DataType = DataType_Sample_All;
-					break;
-				}
-				comp_ofs = ALL_INFO_SIZE;
-				comp_src_adr = pData[i].pData + ALL_INFO_SIZE;
-				comp_org_size = ((pData[i].Size - ALL_INFO_SIZE) / 2);
-				comp_endian = LittleEndian;
-				
+				frame_size += SyroVolcaSample_GetFrameSize_AllComp(&psms[i].Data,
+					psms[i].comp_size, NULL);
+				break;
 			
 			default:
 				break;
 		}
-		
-		if (comp_org_size) {
-			comp_dest_size = SyroComp_GetCompSize(
-				comp_src_adr,
-				comp_org_size,
-				pData[i].Quality,
-				comp_endian
-			);
-
-			comp_dest_size = (comp_dest_size + BLOCK_SIZE - 1) & (~(BLOCK_SIZE-1));
-			psms[i].comp_size = (comp_dest_size + comp_ofs);
-			psms[i].comp_buf = malloc(comp_dest_size + comp_ofs);
-			if (!psms[i].comp_buf) {
-				SyroVolcaSample_FreeCompressMemory(psm);
-				free((uint8_t *)psm);
-				return Status_NotEnoughMemory;
-			};
-			memset(psms[i].comp_buf, 0, comp_dest_size);
-			if (comp_ofs) {
-				memcpy(psms[i].comp_buf, pData[i].pData, comp_ofs);
-			}
-			SyroComp_Comp(comp_src_adr, (psms[i].comp_buf+comp_ofs), comp_org_size, 
-				pData[i].Quality, comp_endian);
-		}
 	}
 
 	SyroVolcaSample_SetupNextData(psm);
@@ -739,6 +998,101 @@ SyroStatus SyroVolcaSample_Start(SyroHandle *pHandle, SyroData *pData, int NumOf
 	return Status_Success;
 }
 
+/*======================================================================
+	Syro Get Data Frame Size
+	  number of frames the data takes in the stream, without the footer.
+	  compressed data is sized with SyroComp_GetCompSize.
+	  ret : 0 if the data is not valid.
+ ======================================================================*/
+uint32_t SyroVolcaSample_GetDataFrameSize(SyroData *pData)
+{
+	return SyroVolcaSample_GetDataFrameSplit(pData, NULL);
+}
+
+/*======================================================================
+	Syro Get Data Frame Split
+	  same as SyroVolcaSample_GetDataFrameSize, also splitting the frames
+	  into the header gap, header, blocks and erase gaps in *pSplit
+	  (if not NULL, all 0 if the data is not valid).
+ ======================================================================*/
+uint32_t SyroVolcaSample_GetDataFrameSplit(SyroData *pData, SyroFrameSplit *pSplit)
+{
+	uint32_t comp_size;
+	
+	if (pSplit) {
+		memset(pSplit, 0, sizeof(SyroFrameSplit));
+	}
+	
+	switch (pData->DataType) {
+		case DataType_Sample_All:
+			if (pData->Size < ALL_INFO_SIZE) {
+				return 0;
+			}
+			return SyroVolcaSample_GetFrameSize_All(pData->Size, pSplit);
+		
+		case DataType_Sample_AllCompress:
+			if ((pData->Size < ALL_INFO_SIZE) || (pData->Quality < 8) || (pData->Quality > 16)) {
+				return 0;
+			}
+			if (pData->Size == ALL_INFO_SIZE) {
+				return SyroVolcaSample_GetFrameSize_All(pData->Size, pSplit);
+			}
+			comp_size = SyroComp_GetCompSize(
+				(pData->pData + ALL_INFO_SIZE),
+				((pData->Size - ALL_INFO_SIZE) / 2),
+				pData->Quality,
+				LittleEndian
+			);
+			return SyroVolcaSample_GetFrameSize_AllComp(pData, (comp_size + ALL_INFO_SIZE), pSplit);
+		
+		case DataType_Pattern:
+			return SyroVolcaSample_GetFrameSize_Pattern(pSplit);
+		
+		case DataType_Sample_Compress:
+			if ((pData->Quality < 8) || (pData->Quality > 16)) {
+				return 0;
+			}
+			comp_size = 0;
+			if (pData->Size / 2) {
+				comp_size = SyroComp_GetCompSize(
+					pData->pData,
+					(pData->Size / 2),
+					pData->Quality,
+					pData->SampleEndian
+				);
+			}
+			return SyroVolcaSample_GetFrameSize_Sample_Comp(pData, comp_size, pSplit);
+		
+		case DataType_Sample_Erase:
+			return SyroVolcaSample_GetFrameSize_Sample(0, pSplit);
+		
+		case DataType_Sample_Liner:
+			return SyroVolcaSample_GetFrameSize_Sample(pData->Size, pSplit);
+		
+		default:
+			return 0;
+	}
+}
+
+/*======================================================================
+	Syro Get Comp Frame Size
+	  number of frames a DataType_Sample_Compress data takes in the stream,
+	  from a compressed size already got with SyroComp_GetCompSize.
+ ======================================================================*/
+uint32_t SyroVolcaSample_GetCompFrameSize(SyroData *pData, uint32_t comp_size)
+{
+	return SyroVolcaSample_GetFrameSize_Sample_Comp(pData, comp_size, NULL);
+}
+
+/*======================================================================
+	Syro Get Footer Frame Size
+	  number of frames added after the last data.
+ ======================================================================*/
+uint32_t SyroVolcaSample_GetFooterFrameSize(void)
+{
+	return NUM_OF_FRAME__GAP_FOOTER;
+}
+
 /*======================================================================
 	Syro Get Sample
  ======================================================================*/	
@@ -759,6 +1113,7 @@ SyroStatus SyroVolcaSample_GetSample(SyroHandle Handle, int16_t *pLeft, int16_t
 	*pRight = SyroVolcaSample_GetChSample(psm, 1);
 	
 	psm->FrameCountInCycle--;
+	psm->FrameCount++;
 	if ((++psm->CyclePos) == KORGSYRO_NUM_OF_CYCLE_BUF) {
 		psm->CyclePos = 0;
 	}
@@ -770,6 +1125,197 @@ SyroStatus SyroVolcaSample_GetSample(SyroHandle Handle, int16_t *pLeft, int16_t
 	return Status_Success;
 }
 
+/*======================================================================
+	Syro Get Samples
+	  pDest = pointer to store frames (16bit stereo, little endian).
+	  NumOfFrame = number of frames to store.
+	  if the stream ends first, the rest is filled with the last frame.
+ ======================================================================*/	
+SyroStatus SyroVolcaSample_GetSamples(SyroHandle Handle, uint8_t *pDest, uint32_t NumOfFrame)
+{
+	SyroManage *psm;
+	int16_t left, right;
+	uint32_t len;
+	
+	psm = (SyroManage *)Handle;
+	if (psm->Header != SYRO_MANAGE_HEADER) {
+		return Status_InvalidHandle;
+	}
+	
+	while (NumOfFrame) {
+		if (!psm->FrameCountInCycle) {
+			left = (int16_t)psm->Channel[0].Lpf_z;
+			right = (int16_t)psm->Channel[1].Lpf_z;
+			while (NumOfFrame--) {
+				*pDest++ = (uint8_t)left;
+				*pDest++ = (uint8_t)(left >> 8);
+				*pDest++ = (uint8_t)right;
+				*pDest++ = (uint8_t)(right >> 8);
+			}
+			return Status_NoData;
+		}
+		
+		//----- run up to the end of this cycle -----
+		len = KORGSYRO_QAM_CYCLE - (psm->CyclePos % KORGSYRO_QAM_CYCLE);
+		if (len > NumOfFrame) {
+			len = NumOfFrame;
+		}
+		if (len > (uint32_t)psm->FrameCountInCycle) {
+			len = (uint32_t)psm->FrameCountInCycle;
+		}
+		NumOfFrame -= len;
+		psm->FrameCountInCycle -= len;
+		psm->FrameCount += len;
+		
+		SyroVolcaSample_PutFrames(psm, pDest, len);
+		pDest += (len * 4);
+		
+		if (psm->CyclePos == KORGSYRO_NUM_OF_CYCLE_BUF) {
+			psm->CyclePos = 0;
+		}
+		if (!(psm->CyclePos % KORGSYRO_QAM_CYCLE)) {
+			SyroVolcaSample_CycleHandler(psm);
+		}
+	}
+	
+	return Status_Success;
+}
+
+/*======================================================================
+	Syro Get Number
+	  returns the number of the sample (or pattern) being sent by the
+	  frames got so far, or -1 once all of them are sent.
+	  (data is generated one QAM cycle ahead of the frames got)
+ ======================================================================*/	
+int SyroVolcaSample_GetNumber(SyroHandle Handle)
+{
+	SyroManage *psm;
+	SyroManageSingle *psms;
+	
+	psm = (SyroManage *)Handle;
+	if (psm->Header != SYRO_MANAGE_HEADER) {
+		return -1;
+	}
+	
+	if (psm->CurData >= psm->NumOfData) {
+		return -1;
+	}
+	
+	psms = (SyroManageSingle *)(psm+1);
+	return (int)psms[psm->CurData].Data.Number;
+}
+
+/*======================================================================
+	Syro Get Splice
+	  returns the index of the data whose splice point comes next
+	  (NumOfData for the footer), or -1 if it is not known yet.
+	  *pNumOfFrame = frames to get before reaching it, or, if it is
+	  not known, the frames that can be got before one may come.
+	  the splice point of a data is in its header gap, so the frames
+	  from there to the next splice point only depend on that data
+	  (and whether more data follows).
+ ======================================================================*/	
+int SyroVolcaSample_GetSplice(SyroHandle Handle, uint32_t *pNumOfFrame)
+{
+	SyroManage *psm;
+	
+	psm = (SyroManage *)Handle;
+	if (psm->Header != SYRO_MANAGE_HEADER) {
+		return -1;
+	}
+	
+	if ((psm->SpliceData < 0) || (psm->FrameCount > psm->SpliceFrame)) {
+		//----- a splice point is known 2 cycles before its header gap -----
+		*pNumOfFrame = (NUM_OF_GAP_SPLICE_CYCLE - KORGSYRO_NUM_OF_CYCLE) * KORGSYRO_QAM_CYCLE;
+		return -1;
+	}
+	
+	*pNumOfFrame = psm->SpliceFrame - psm->FrameCount;
+	return psm->SpliceData;
+}
+
+/*======================================================================
+	Syro Get Splice State
+	  at a splice point, checks that both channels are steady in the
+	  plain gap, and returns their LPF state in *pState.
+	  ret : false if not at a splice point, or not steady.
+ ======================================================================*/	
+bool SyroVolcaSample_GetSpliceState(SyroHandle Handle, uint32_t *pState)
+{
+	SyroManage *psm;
+	int ch;
+	
+	psm = (SyroManage *)Handle;
+	if (psm->Header != SYRO_MANAGE_HEADER) {
+		return false;
+	}
+	
+	if ((psm->SpliceData < 0) || (psm->FrameCount != psm->SpliceFrame)) {
+		return false;
+	}
+	
+	if ((!psm->PageIsGap[0]) || (!psm->PageIsGap[1]) || (!psm->GapCached)) {
+		return false;
+	}
+	
+	for (ch=0; ch<KORGSYRO_NUM_OF_CHANNEL; ch++) {
+		if (psm->Channel[ch].LastPhase || (psm->Channel[ch].Lpf_z != psm->GapLpf_z[ch])) {
+			return false;
+		}
+	}
+	
+	*pState = (uint32_t)(uint16_t)psm->Channel[0].Lpf_z |
+		((uint32_t)(uint16_t)psm->Channel[1].Lpf_z << 16);
+	return true;
+}
+
+/*======================================================================
+	Syro Skip Data
+	  at the splice point of a data, skips to the splice point of the
+	  next one, as if NumOfFrame frames were got, leaving the channels
+	  in State (see SyroVolcaSample_GetSpliceState). these frames must
+	  be got from a previous stream, e.g., a cache of them.
+ ======================================================================*/	
+SyroStatus SyroVolcaSample_SkipData(SyroHandle Handle, uint32_t NumOfFrame, uint32_t State)
+{
+	SyroManage *psm;
+	uint32_t state;
+	int ch;
+	
+	psm = (SyroManage *)Handle;
+	if (psm->Header != SYRO_MANAGE_HEADER) {
+		return Status_InvalidHandle;
+	}
+	
+	if ((!SyroVolcaSample_GetSpliceState(Handle, &state)) ||
+		(psm->SpliceData >= psm->NumOfData) ||
+		(NumOfFrame % KORGSYRO_QAM_CYCLE))
+	{
+		return Status_IllegalData;
+	}
+	
+	psm->CurData = psm->SpliceData + 1;
+	if (psm->CurData < psm->NumOfData) {
+		SyroVolcaSample_SetupNextData(psm);
+	} else {
+		SyroVolcaSample_SetupFooter(psm);
+	}
+	
+	//----- the gap made up to the next splice point, 2 cycles ahead -----
+	psm->TaskCount -= (NUM_OF_GAP_SPLICE_CYCLE + KORGSYRO_NUM_OF_CYCLE);
+	psm->FrameCount += NumOfFrame;
+	psm->CycleCount += (NumOfFrame / KORGSYRO_QAM_CYCLE);
+	psm->CyclePos = (int)(psm->FrameCount % KORGSYRO_NUM_OF_CYCLE_BUF);
+	psm->SpliceData = psm->CurData;
+	psm->SpliceFrame = psm->FrameCount;
+	
+	for (ch=0; ch<KORGSYRO_NUM_OF_CHANNEL; ch++) {
+		psm->Channel[ch].Lpf_z = (int16_t)(State >> (ch * 16));
+	}
+	
+	return Status_Success;
+}
+
 /*======================================================================
 	Syro End
  ======================================================================*/	
@@ -14,6 +14,11 @@
 
 #define VOLCASAMPLE_PATTERN_SIZE		0xA40
 
+//////////////////////////////////////////////////////////////////
+// Start Flags
+
+#define SYRO_FLAG_PARALLEL_COMPRESS		0x0001		// compress data on all cores
+
 typedef enum {
 	Status_Success,
 
@@ -54,6 +59,13 @@ typedef struct {
 	Endian SampleEndian;
 } SyroData;
 
+typedef struct {
+  uint32_t Gap;     // header gap
+  uint32_t Header;  // header block
+  uint32_t Block;   // data blocks, with the gap before each
+  uint32_t Erase;   // erase gaps, past the gap they replace
+} SyroFrameSplit;
+
 typedef void* SyroHandle;
 
 /*-------------------------*/
@@ -70,10 +82,30 @@ extern "C"
                                    uint32_t Flags,
                                    uint32_t *pNumOfSyroFrame);
 
+  uint32_t SyroVolcaSample_GetDataFrameSize(SyroData *pData);
+
+  uint32_t SyroVolcaSample_GetDataFrameSplit(SyroData *pData, SyroFrameSplit *pSplit);
+
+  uint32_t SyroVolcaSample_GetCompFrameSize(SyroData *pData, uint32_t comp_size);
+
+  uint32_t SyroVolcaSample_GetFooterFrameSize(void);
+
   SyroStatus SyroVolcaSample_GetSample(SyroHandle Handle,
                                        int16_t *pLeft,
                                        int16_t *pRight);
 
+  SyroStatus SyroVolcaSample_GetSamples(SyroHandle Handle,
+                                        uint8_t *pDest,
+                                        uint32_t NumOfFrame);
+
+  int SyroVolcaSample_GetNumber(SyroHandle Handle);
+
+  int SyroVolcaSample_GetSplice(SyroHandle Handle, uint32_t *pNumOfFrame);
+
+  bool SyroVolcaSample_GetSpliceState(SyroHandle Handle, uint32_t *pState);
+
+  SyroStatus SyroVolcaSample_SkipData(SyroHandle Handle, uint32_t NumOfFrame, uint32_t State);
+
   SyroStatus SyroVolcaSample_End(SyroHandle Handle);
 
 #ifdef __cplusplus
@@ -0,0 +1,338 @@
+// ----------------------------------------
+//  On disk cache of compressed sample blocks
+// ----------------------------------------
+//
+//  The Syro compression works on blocks of VOLCASAMPLE_COMP_BLOCK_LEN
+//  samples, each one on its own. Every block compressed is kept in a
+//  file named after the hash of its samples, its quality and endian:
+//
+//    DIR/HH/HHHHHHHHHHHHHHHH-QQ-E
+//
+//  so the blocks of a sample that didn't change, or only changed past
+//  them, are read back instead of compressed again. The file holds the
+//  number of samples and byte size of the block, which are checked when
+//  it is read, followed by the block itself.
+//
+//  Files are written under a temporary name and renamed, so workers
+//  storing the same block at once, or an interrupted run, never leave a
+//  partial block behind.
+//
+//  Planning only needs the size of a block at each quality, worked out
+//  from its bit map. Those sizes are kept apart, in DIR/sizes, a record
+//  per block, quality and endian: read whole when the cache is opened,
+//  looked up in memory, and the new ones appended when it is closed. A
+//  file cut short by an interrupted run is written again whole.
+// ----------------------------------------
+
+// For mkstemp() and snprintf()
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "volcacache.h"
+#include "volcastate.h"
+
+#define CACHE_MAGIC       "VCB1"
+#define CACHE_HEADER_SIZE 8
+
+#define SIZES_FILE        "sizes"
+#define SIZES_MAGIC       "VCS1"
+#define SIZES_RECORD      16   // hash (8), samples (2), quality, endian, length (4)
+#define SIZES_CAPACITY    4096 // sizes held before growing
+
+static void cache_path(block_cache *cache, char *path, size_t size, const uint8_t *psrc,
+                       int num_of_sample, int quality, Endian sample_endian) {
+
+	uint64_t hash = state_hash((uint8_t *) psrc, num_of_sample * 2);
+
+	snprintf(path, size, "%s/%02x/%016llx-%02d-%c", cache->dir,
+	         (unsigned) (hash >> 56), (unsigned long long) hash, quality,
+	         sample_endian == LittleEndian ? 'l' : 'b');
+}
+
+static int cache_load(void *param, const uint8_t *psrc, int num_of_sample, int quality,
+                      Endian sample_endian, uint8_t *pdest) {
+
+	block_cache *cache = param;
+	char path[4096];
+	uint8_t header[CACHE_HEADER_SIZE];
+	FILE *fp;
+	int len = 0;
+
+	cache_path(cache, path, sizeof(path), psrc, num_of_sample, quality, sample_endian);
+
+	fp = fopen(path, "rb");
+	if (!fp) return 0;
+
+	if (fread(header, 1, CACHE_HEADER_SIZE, fp) == CACHE_HEADER_SIZE
+	    && !memcmp(header, CACHE_MAGIC, 4)
+	    && (header[4] | header[5] << 8) == num_of_sample) {
+		len = header[6] | header[7] << 8;
+		if (len > VOLCASAMPLE_COMP_BLOCK_SIZE_MAX) len = 0;
+		if (len && fread(pdest, 1, len, fp) != (size_t) len) len = 0;
+	}
+
+	fclose(fp);
+
+	if (len) atomic_fetch_add(&cache->loaded, 1);
+	return len;
+}
+
+static void cache_store(void *param, const uint8_t *psrc, int num_of_sample, int quality,
+                        Endian sample_endian, const uint8_t *pcomp, int len) {
+
+	block_cache *cache = param;
+	char path[4096], tmpfile[4096];
+	uint8_t header[CACHE_HEADER_SIZE] = { 'V', 'C', 'B', '1',
+		num_of_sample & 0xFF, num_of_sample >> 8, len & 0xFF, len >> 8 };
+	FILE *fp;
+	int fd, ok;
+
+	cache_path(cache, path, sizeof(path), psrc, num_of_sample, quality, sample_endian);
+
+	// Make the HH directory, next to the file name
+	snprintf(tmpfile, sizeof(tmpfile), "%s", path);
+	*strrchr(tmpfile, '/') = '\0';
+	if (mkdir(tmpfile, 0755) && errno != EEXIST) return;
+
+	strcat(tmpfile, "/.tmpXXXXXX");
+	fd = mkstemp(tmpfile);
+	if (fd < 0) return;
+
+	fp = fdopen(fd, "wb");
+	if (!fp) {
+		close(fd);
+		unlink(tmpfile);
+		return;
+	}
+
+	ok = fwrite(header, 1, CACHE_HEADER_SIZE, fp) == CACHE_HEADER_SIZE
+		&& fwrite(pcomp, 1, len, fp) == (size_t) len;
+	ok = !fclose(fp) && ok && !rename(tmpfile, path);
+
+	if (ok) atomic_fetch_add(&cache->stored, 1);
+	else unlink(tmpfile);
+}
+
+// ----------------------------------------
+// Block sizes
+// ----------------------------------------
+static void size_key(block_size *key, const uint8_t *psrc, int num_of_sample, int quality,
+                     Endian sample_endian) {
+	key->hash = state_hash((uint8_t *) psrc, num_of_sample * 2);
+	key->num_of_sample = num_of_sample;
+	key->quality = quality;
+	key->endian = sample_endian == LittleEndian ? 'l' : 'b';
+	key->len = 0;
+}
+
+// Slot of the index holding the block size, or the empty one it goes in
+static uint32_t *size_slot(block_cache *cache, block_size *key) {
+
+	uint32_t i = (uint32_t) (key->hash ^ key->hash >> 32) + key->quality * 31 + key->endian;
+	block_size *entry;
+
+	for (i &= cache->index_mask; cache->index[i]; i = (i + 1) & cache->index_mask) {
+		entry = &cache->sizes[cache->index[i] - 1];
+		if (entry->hash == key->hash && entry->num_of_sample == key->num_of_sample
+		    && entry->quality == key->quality && entry->endian == key->endian)
+			break;
+	}
+
+	return &cache->index[i];
+}
+
+// Add a block size unless known, the index is kept at most half full
+static int size_add(block_cache *cache, block_size *size) {
+
+	uint32_t capacity = cache->sizes_capacity * 2, *slot, *index;
+	block_size *sizes;
+
+	if (cache->sizes_count == cache->sizes_capacity) {
+		index = calloc(capacity * 2, sizeof(uint32_t));
+		sizes = index ? realloc(cache->sizes, capacity * sizeof(block_size)) : NULL;
+		if (!sizes) {
+			free(index);
+			return 0;
+		}
+
+		free(cache->index);
+		cache->sizes = sizes;
+		cache->sizes_capacity = capacity;
+		cache->index = index;
+		cache->index_mask = capacity * 2 - 1;
+		for (uint32_t i = 0; i < cache->sizes_count; i++)
+			*size_slot(cache, &cache->sizes[i]) = i + 1;
+	}
+
+	slot = size_slot(cache, size);
+	if (!*slot) {
+		cache->sizes[cache->sizes_count++] = *size;
+		*slot = cache->sizes_count;
+	}
+
+	return 1;
+}
+
+static int cache_load_size(void *param, const uint8_t *psrc, int num_of_sample, int quality,
+                           Endian sample_endian) {
+
+	block_cache *cache = param;
+	block_size key;
+	uint32_t *slot;
+	int len = 0;
+
+	size_key(&key, psrc, num_of_sample, quality, sample_endian);
+
+	pthread_mutex_lock(&cache->lock);
+	slot = size_slot(cache, &key);
+	if (*slot) len = cache->sizes[*slot - 1].len;
+	pthread_mutex_unlock(&cache->lock);
+
+	return len;
+}
+
+static void cache_store_size(void *param, const uint8_t *psrc, int num_of_sample, int quality,
+                             Endian sample_endian, int len) {
+
+	block_cache *cache = param;
+	block_size size;
+
+	size_key(&size, psrc, num_of_sample, quality, sample_endian);
+	size.len = len;
+
+	pthread_mutex_lock(&cache->lock);
+	size_add(cache, &size);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+// Read DIR/sizes, sizes_read is left at 0 unless it is whole, so it is
+// written again
+static void sizes_read(block_cache *cache) {
+
+	char path[4096];
+	uint8_t record[SIZES_RECORD];
+	block_size size;
+	size_t got = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/" SIZES_FILE, cache->dir);
+
+	fp = fopen(path, "rb");
+	if (!fp) return;
+
+	if (fread(record, 1, 4, fp) == 4 && !memcmp(record, SIZES_MAGIC, 4)) {
+		while ((got = fread(record, 1, SIZES_RECORD, fp)) == SIZES_RECORD) {
+			size.hash = 0;
+			for (int i = 7; i >= 0; i--) size.hash = size.hash << 8 | record[i];
+			size.num_of_sample = record[8] | record[9] << 8;
+			size.quality = record[10];
+			size.endian = record[11];
+			size.len = record[12] | record[13] << 8 | record[14] << 16 | (uint32_t) record[15] << 24;
+			if (!size_add(cache, &size)) break;
+		}
+		if (!got && feof(fp)) cache->sizes_read = cache->sizes_count;
+	}
+
+	fclose(fp);
+}
+
+// Append the sizes worked out since, or write them all again under a
+// temporary name
+static void sizes_write(block_cache *cache) {
+
+	char path[4096], tmpfile[4096];
+	uint8_t record[SIZES_RECORD];
+	bool append = cache->sizes_read > 0;
+	block_size *size;
+	FILE *fp = NULL;
+	int fd, ok;
+
+	if (cache->sizes_count == cache->sizes_read) return;
+
+	snprintf(path, sizeof(path), "%s/" SIZES_FILE, cache->dir);
+
+	if (append) {
+		fp = fopen(path, "ab");
+	} else {
+		snprintf(tmpfile, sizeof(tmpfile), "%s/.tmpXXXXXX", cache->dir);
+		fd = mkstemp(tmpfile);
+		if (fd >= 0 && !(fp = fdopen(fd, "wb"))) {
+			close(fd);
+			unlink(tmpfile);
+		}
+	}
+	if (!fp) return;
+
+	ok = append || fwrite(SIZES_MAGIC, 1, 4, fp) == 4;
+
+	for (uint32_t i = cache->sizes_read; ok && i < cache->sizes_count; i++) {
+		size = &cache->sizes[i];
+		for (int j = 0; j < 8; j++) record[j] = size->hash >> (j * 8);
+		record[8] = size->num_of_sample & 0xFF;
+		record[9] = size->num_of_sample >> 8;
+		record[10] = size->quality;
+		record[11] = size->endian;
+		for (int j = 0; j < 4; j++) record[12 + j] = size->len >> (j * 8);
+		ok = fwrite(record, 1, SIZES_RECORD, fp) == SIZES_RECORD;
+	}
+
+	ok = !fclose(fp) && ok;
+	if (!append && !(ok && !rename(tmpfile, path))) unlink(tmpfile);
+}
+
+// ----------------------------------------
+// Cache handling
+// ----------------------------------------
+int cache_open(block_cache *cache, char *dir) {
+
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		printf("error! can't create %s\n", dir);
+		return 0;
+	}
+
+	cache->sizes = malloc(SIZES_CAPACITY * sizeof(block_size));
+	cache->index = calloc(SIZES_CAPACITY * 2, sizeof(uint32_t));
+	if (!cache->sizes || !cache->index) {
+		printf("error! not enough memory\n");
+		free(cache->sizes);
+		free(cache->index);
+		return 0;
+	}
+
+	cache->dir = dir;
+	cache->sizes_count = 0;
+	cache->sizes_read = 0;
+	cache->sizes_capacity = SIZES_CAPACITY;
+	cache->index_mask = SIZES_CAPACITY * 2 - 1;
+	sizes_read(cache);
+
+	pthread_mutex_init(&cache->lock, NULL);
+	atomic_init(&cache->loaded, 0);
+	atomic_init(&cache->stored, 0);
+	cache->callbacks.param = cache;
+	cache->callbacks.Load = cache_load;
+	cache->callbacks.Store = cache_store;
+	cache->callbacks.LoadSize = cache_load_size;
+	cache->callbacks.StoreSize = cache_store_size;
+
+	SyroComp_SetCache(&cache->callbacks);
+	return 1;
+}
+
+void cache_close(block_cache *cache) {
+	SyroComp_SetCache(NULL);
+	sizes_write(cache);
+
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->sizes);
+	free(cache->index);
+	cache->sizes = NULL;
+	cache->index = NULL;
+	cache->dir = NULL;
+}
@@ -0,0 +1,41 @@
+// ----------------------------------------
+//  On disk cache of compressed sample blocks
+// ----------------------------------------
+
+#ifndef __VOLCACACHE_H__
+#define __VOLCACACHE_H__
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "korg/korg_syro_volcasample.h"
+#include "korg/korg_syro_comp.h"
+
+typedef struct {
+  uint64_t hash;            // of the block samples
+  uint16_t num_of_sample;
+  uint8_t quality;
+  uint8_t endian;
+  uint32_t len;             // bytes of the compressed block
+} block_size;
+
+typedef struct {
+  char *dir;
+  atomic_uint loaded;       // blocks read back
+  atomic_uint stored;       // blocks compressed and written
+  SyroCompCache callbacks;
+  pthread_mutex_t lock;     // guards the sizes
+  block_size *sizes;        // the ones read from DIR/sizes first
+  uint32_t sizes_count, sizes_read, sizes_capacity;
+  uint32_t *index;          // open addressing into sizes, 0 for empty
+  uint32_t index_mask;
+} block_cache;
+
+// ----------------------------------------
+// Cache handling, used by the Syro compression while open
+// ----------------------------------------
+int  cache_open(block_cache *cache, char *dir);
+void cache_close(block_cache *cache);  // the new sizes are written to DIR/sizes
+
+
+#endif  // #ifndef __VOLCACACHE_H__
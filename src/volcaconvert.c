@@ -0,0 +1,394 @@
+// ----------------------------------------
+//
+//  volcaconvert
+//	============
+//
+//  Sample converter for Korg Volca Sample
+//
+//  author: Agustín Mista (GitHub: @agustinmista)
+//  date: 2019 June 1st
+//  url: http://github.com/agustinmista/volcamatic
+//  license: MIT license
+//
+//  Note: WAV files are decoded in process, anything else is decoded by
+//        ffmpeg first (http://ffmpeg.org)
+//
+// ----------------------------------------
+
+// For C99!
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "korg/korg_syro_thread.h"
+#include "volcautils.h"
+#include "volcapcm.h"
+#include "volcaresample.h"
+#include "volcastretch.h"
+
+#define OUTPUT_EXT    "volca"
+#define OUTPUT_FS     STREAM_FS
+#define MEMORY_BUDGET 256  // MB of samples in flight
+
+typedef struct {
+  char *filename;
+  char *outfile;
+  bool native;     // WAV file, otherwise decoded by ffmpeg
+} convert_job;
+
+typedef struct {
+  convert_job *jobs;
+  double speed;
+  uint32_t fs;
+  uint64_t budget;      // bytes
+  uint64_t in_flight;
+  int converted;
+  int errored;
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+} convert_pool;
+
+
+// ----------------------------------------
+// Output file names, as the old script used
+// ----------------------------------------
+static char *output_name(char *filename, char *speed, char *ext) {
+
+  size_t size = strlen(filename) + (speed ? strlen(speed) + 2 : 0) + strlen(ext) + 2;
+  char *name = malloc(size);
+
+  if (!name) return NULL;
+
+  if (speed) snprintf(name, size, "%s.%sx.%s", filename, speed, ext);
+  else snprintf(name, size, "%s.%s", filename, ext);
+
+  return name;
+}
+
+// ----------------------------------------
+// Memory budget
+//
+// A job waits until its buffers fit in the budget, unless nothing else
+// is in flight, so a single sample larger than the budget still runs
+// ----------------------------------------
+static uint64_t convert_cost(wav_info *wav, double speed, uint32_t fs) {
+
+  uint64_t frames = pcm_frame_count(wav), stretched = frames, resampled;
+  uint64_t cost = wav->data_size + frames * 2;
+
+  if (speed != 1.0) {
+    stretched = stretch_frame_count(frames, speed);
+    cost += frames * 4 + stretched * 6;
+  }
+
+  if (wav->fs != fs) {
+    resampled = resample_frame_count(stretched, wav->fs, fs);
+    cost += stretched * 4 + resampled * 2;
+  }
+
+  return cost;
+}
+
+static void acquire_memory(convert_pool *pool, uint64_t cost) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->in_flight && pool->in_flight + cost > pool->budget)
+    pthread_cond_wait(&pool->released, &pool->lock);
+  pool->in_flight += cost;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void release_memory(convert_pool *pool, uint64_t cost) {
+  pthread_mutex_lock(&pool->lock);
+  pool->in_flight -= cost;
+  pthread_cond_broadcast(&pool->released);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// ----------------------------------------
+// Decode a non WAV file into a mono 16 bit WAV file with ffmpeg. Its
+// messages go to FILE.log, which is removed if everything went fine
+// ----------------------------------------
+static int decode_ffmpeg(char *filename, char *outfile) {
+
+  char *logfile = output_name(filename, NULL, "log");
+  int status, fd, ok;
+  pid_t pid;
+
+  if (!logfile) return 0;
+
+  pid = fork();
+
+  if (pid == 0) {
+    fd = open(logfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) dup2(fd, STDERR_FILENO);
+
+    execlp("ffmpeg", "ffmpeg", "-nostdin", "-y", "-i", filename,
+           "-f", "wav", "-acodec", "pcm_s16le", "-ac", "1", outfile, (char *) NULL);
+
+    fprintf(stderr, "could not run ffmpeg\n");
+    _exit(127);
+  }
+
+  ok = pid > 0 && waitpid(pid, &status, 0) == pid
+    && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+  if (ok) unlink(logfile);
+  free(logfile);
+
+  return ok;
+}
+
+// ----------------------------------------
+// Downmix, stretch and resample a whole sample
+// ----------------------------------------
+static int16_t *convert_frames(wav_info *wav, double speed, uint32_t fs,
+                               uint32_t *pframe_count) {
+
+  uint32_t frame_count = pcm_frame_count(wav);
+  int16_t *frames, *converted;
+
+  frames = malloc(frame_count * 2);
+  if (!frames) return NULL;
+  pcm_to_mono16(wav, frames);
+
+  if (speed != 1.0) {
+    converted = stretch_mono16(frames, frame_count, wav->fs, speed, &frame_count);
+    free(frames);
+    if (!converted) return NULL;
+    frames = converted;
+  }
+
+  if (wav->fs != fs) {
+    converted = resample_mono16(frames, frame_count, wav->fs, fs, &frame_count);
+    free(frames);
+    if (!converted) return NULL;
+    frames = converted;
+  }
+
+  *pframe_count = frame_count;
+  return frames;
+}
+
+// ----------------------------------------
+// Convert a single file, run by the workers
+// ----------------------------------------
+static void convert_file(void *param, int index) {
+
+  convert_pool *pool = param;
+  convert_job *job = &pool->jobs[index];
+  char *source = job->filename, *decoded = NULL;
+  uint8_t *src = NULL;
+  uint32_t size, frame_count;
+  uint64_t cost = 0;
+  int16_t *frames = NULL;
+  wav_info wav;
+  bool ok = false;
+
+  if (!job->native) {
+    decoded = output_name(job->outfile, NULL, "tmp");
+    source = decoded && decode_ffmpeg(job->filename, decoded) ? decoded : NULL;
+  }
+
+  if (source) src = map_file(source, &size);
+
+  if (src && parse_wav(src, size, &wav) && pcm_supported(&wav)) {
+    cost = convert_cost(&wav, pool->speed, pool->fs);
+    acquire_memory(pool, cost);
+    frames = convert_frames(&wav, pool->speed, pool->fs, &frame_count);
+  }
+
+  if (src) unmap_file(src, size);
+
+  // Files are written in parallel, only the messages and counters are
+  // serialized, so each one comes out whole
+  if (frames) ok = write_wav_mono16(job->outfile, frames, frame_count, pool->fs);
+
+  pthread_mutex_lock(&pool->lock);
+  printf("resampling %s... ", job->filename);
+
+  if (ok) {
+    printf("ok! [%d bytes]\n", WAV_POS_DATA_SIZE + 4 + frame_count * 2);
+  } else if (frames) {
+    printf("error! could not write %s\n", job->outfile);
+  } else if (!source) {
+    printf("error! see %s.log for more info\n", job->filename);
+  } else {
+    printf("error! could not convert\n");
+  }
+
+  ok ? pool->converted++ : pool->errored++;
+  pthread_mutex_unlock(&pool->lock);
+
+  free(frames);
+  if (cost) release_memory(pool, cost);
+
+  if (decoded) {
+    unlink(decoded);
+    free(decoded);
+  }
+}
+
+// ----------------------------------------
+// Check the WAV files before converting any of them
+// ----------------------------------------
+static int check_file(char *filename, convert_job *job) {
+
+  uint8_t *src;
+  uint32_t size;
+  wav_info wav;
+  int ok;
+
+  printf("checking %s... ", filename);
+
+  src = map_file(filename, &size);
+  if (!src) return 0;
+
+  job->native = size >= 4 && !memcmp(src, wav_header, 4);
+
+  if (job->native) {
+    ok = parse_wav(src, size, &wav) && pcm_supported(&wav);
+    if (ok) printf("ok! [%dch] [%d bits] [%d Hz]\n",
+                   wav.channel_count, wav.bit_depth, wav.fs);
+  } else {
+    ok = 1;
+    printf("ok! [decoded by ffmpeg]\n");
+  }
+
+  unmap_file(src, size);
+  return ok;
+}
+
+// ----------------------------------------
+// Print usage message
+// ----------------------------------------
+static void print_usage(char *bin) {
+  printf(
+    "\nUsage: %s [OPTIONS] FILES"
+    "\nConverts sound files into the WAV format supported by the Korg Volca Sample"
+    "\n"
+    "\nEach FILE is written to FILE." OUTPUT_EXT " (FILE.SPEEDx." OUTPUT_EXT
+    "\nwith -s) as mono 16 bit. WAV files are decoded in process, other"
+    "\nformats need ffmpeg."
+    "\n"
+    "\nOptional arguments:"
+    "\n  -s SPEED    change the tempo of the samples, keeping their pitch"
+    "\n  -r FS       output sample rate (default: %d, the Volca Sample"
+    "\n              plays %d natively)"
+    "\n  -j N        number of files converted at once (default: one per core)"
+    "\n  -m MB       memory budget for the files in flight (default: %d)"
+    "\n  -h          print this help message"
+    "\n",
+    bin, OUTPUT_FS, VOLCA_NATIVE_FS, MEMORY_BUDGET);
+}
+
+// ----------------------------------------
+// Main
+// ----------------------------------------
+int main(int argc, char **argv) {
+
+  convert_pool pool;
+  convert_job *jobs;
+  int jobs_count = 0, errored = 0;
+  int threads = SyroThread_GetNumOfThread();
+  int budget = MEMORY_BUDGET;
+  char *speed = NULL;
+
+  pool.speed = 1.0;
+  pool.fs = OUTPUT_FS;
+
+  // Parse command line options
+  int opt;
+
+  while ((opt = getopt (argc, argv, "s:r:j:m:h")) != -1){
+    switch (opt) {
+    case 's':
+      speed = optarg;
+      pool.speed = atof(optarg);
+      if (pool.speed < STRETCH_MIN_SPEED || pool.speed > STRETCH_MAX_SPEED) {
+        printf("error! speed out of range: %s (%.2f-%.0f)\n",
+               optarg, STRETCH_MIN_SPEED, STRETCH_MAX_SPEED);
+        return 1;
+      }
+      if (pool.speed == 1.0) speed = NULL;
+      break;
+    case 'r':
+      if (atoi(optarg) <= 0) {
+        printf("error! invalid sample rate: %s\n", optarg);
+        return 1;
+      }
+      pool.fs = atoi(optarg);
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      if (threads < 1) threads = 1;
+      break;
+    case 'm':
+      budget = atoi(optarg);
+      if (budget < 1) budget = 1;
+      break;
+    case 'h':
+    case '?':
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind == argc) {
+    printf("nothing to convert here\n");
+    return 0;
+  }
+
+  if (speed) printf("resampling samples at %sx speed\n", speed);
+
+  // Check every file first, the ones left are converted in parallel
+  jobs = malloc((argc - optind) * sizeof(convert_job));
+  if (!jobs) {
+    printf("error! not enough memory\n");
+    return 1;
+  }
+
+  for (int file_arg = optind; file_arg < argc; file_arg++) {
+    convert_job *job = &jobs[jobs_count];
+
+    if (!check_file(argv[file_arg], job)) {
+      errored++;
+      continue;
+    }
+
+    job->filename = argv[file_arg];
+    job->outfile = output_name(argv[file_arg], speed, OUTPUT_EXT);
+
+    if (job->outfile) {
+      jobs_count++;
+    } else {
+      printf("error! not enough memory for %s\n", argv[file_arg]);
+      errored++;
+    }
+  }
+
+  pool.jobs = jobs;
+  pool.budget = (uint64_t) budget << 20;
+  pool.in_flight = 0;
+  pool.converted = 0;
+  pool.errored = errored;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.released, NULL);
+
+  SyroThread_Run(convert_file, &pool, jobs_count, threads);
+
+  pthread_cond_destroy(&pool.released);
+  pthread_mutex_destroy(&pool.lock);
+
+  for (int i = 0; i < jobs_count; i++) free(jobs[i].outfile);
+  free(jobs);
+
+  printf("done! [%d samples converted] [%d errors]\n", pool.converted, pool.errored);
+
+  return pool.errored ? 1 : 0;
+}
@@ -27,6 +27,7 @@
 
 #include "korg/korg_syro_volcasample.h"
 #include "volcautils.h"
+#include "volcaplan.h"
 
 // ----------------------------------------
 // Print samples erasing map
@@ -54,11 +55,19 @@ static void print_usage(char *bin) {
     "\nSample eraser for Korg Volca Sample"
     "\n"
     "\nOptional arguments:"
-    "\n  -o FILE     specify the output file name (default: \"syro.wav\")"
+    "\n  -o FILE     specify the output file name (default: \"syro.wav\"), use -"
+    "\n              to stream to stdout, e.g., %s -o - ... | aplay"
+    "\n  -f FORMAT   output format: wav (default) or raw, i.e., S16_LE stereo"
+    "\n              at 44100 Hz without header"
+    "\n  -p FILE     write the progress to FILE as it is sent, one line of"
+    "\n              \"FRAMES_SENT FRAMES SAMPLE_NUMBER\" every 0.1 seconds"
+    "\n              (see volcaflash -p)"
+    "\n  -n          dry run: print how long the stream takes, sample by"
+    "\n              sample, without writing it"
     "\n  -t          print a table with the samples to modify"
     "\n  -h          print this help message"
     "\n",
-    bin);
+    bin, bin);
 }
 
 
@@ -71,23 +80,38 @@ int main(int argc, char **argv) {
 	SyroData *syro_data_ptr = syro_data;
   SyroStatus status;
 	SyroHandle handle;
-	uint8_t *buf_dest;
-	int16_t left, right;
-	uint32_t size_dest, frame, write_pos;
+	uint32_t frame;
+	int written;
 	int to_erase_count = 0;
   bool to_erase[100] = { false };
   bool print_table = false;
+  bool dry_run = false;
 
 
   // Parse command line options
   int opt;
   char *outfile = "syro.wav";
+  char *progress_file = NULL;
+  stream_options options = { false, NULL, NULL, NULL };
 
-  while ((opt = getopt (argc, argv, "o:th")) != -1){
+  while ((opt = getopt (argc, argv, "o:f:p:nth")) != -1){
     switch (opt) {
     case 'o':
       outfile = optarg;
       break;
+    case 'f':
+      if (strcmp(optarg, "wav") && strcmp(optarg, "raw")) {
+        print_usage(argv[0]);
+        return 1;
+      }
+      options.raw = !strcmp(optarg, "raw");
+      break;
+    case 'p':
+      progress_file = optarg;
+      break;
+    case 'n':
+      dry_run = true;
+      break;
     case 't':
       print_table = true;
       break;
@@ -98,32 +122,25 @@ int main(int argc, char **argv) {
     }
   }
 
+  // Keep stdout for the stream
+  if (!strcmp(outfile, "-")) redirect_messages();
+
 
   // Loop over the input arguments marking samples to erase
   for (int samples_arg = optind; samples_arg < argc; samples_arg++) {
 
-    int n1, n2;
+    int first, last;
     char *arg = argv[samples_arg];
 
-    // If the dash appears in the argument, we try to parse it as an interval.
-    // Otherwise we try to parse it as a single number.
-    if (strchr(arg, '-') != NULL) {
-      if (sscanf(arg, "%d-%d", &n1, &n2) == 2 && VALID(n1) && VALID(n2)) {
-        for (int i = MIN(n1, n2); i <= MAX(n1, n2); i++) {
-          to_erase[i] = true;
-          to_erase_count++;
-        }
-      } else {
-        printf("invalid interval: %s\n", arg);
-        return 1;
-      }
-    } else if (sscanf(arg, "%d", &n1) == 1 && VALID(n1)) {
-      to_erase[n1] = true;
-      to_erase_count++;
-    } else {
+    if (!parse_sample_range(arg, &first, &last)) {
       printf("invalid input: %s\n", arg);
       return 1;
     }
+
+    for (int i = first; i <= last; i++) {
+      if (!to_erase[i]) to_erase_count++;
+      to_erase[i] = true;
+    }
   }
 
 	if (to_erase_count) {
@@ -146,6 +163,12 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (dry_run) {
+    written = plan_dry_run(syro_data, to_erase_count, 0);
+    free_syrodata(syro_data, to_erase_count);
+    return written ? 0 : 1;
+  }
+
 	// Start conversion
   printf("starting Syro stream conversion... ");
 	status = SyroVolcaSample_Start(&handle, syro_data, to_erase_count, 0, &frame);
@@ -155,35 +178,21 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-  // Allocate memory for the output file
-	size_dest = frame * 4 + sizeof(wav_header);
-	buf_dest = malloc(size_dest);
-
-  // Copy the wav header to the output file
-	memcpy(buf_dest, wav_header, sizeof(wav_header));
-	set_32bit_value(buf_dest + WAV_POS_RIFF_SIZE, frame * 4 + 0x24);
-	set_32bit_value(buf_dest + WAV_POS_DATA_SIZE, frame * 4);
-
-	// Get each converted sample from the SDK
-	write_pos = sizeof(wav_header);
-	while (frame) {
-		SyroVolcaSample_GetSample(handle, &left, &right);
-		buf_dest[write_pos++] = (uint8_t) left;
-		buf_dest[write_pos++] = (uint8_t) (left >> 8);
-		buf_dest[write_pos++] = (uint8_t) right;
-		buf_dest[write_pos++] = (uint8_t) (right >> 8);
-		frame--;
-	}
+  // One erase per sample, each paying a whole header gap
+  printf("ok! [%.2f seconds]\n", (double) frame / STREAM_FS);
+
+	// Convert and write the output file one chunk at a time
+  if (progress_file) options.progress = open_progress(progress_file);
+
+  printf("writing Syro output to %s... ", strcmp(outfile, "-") ? outfile : "stdout");
+	written = write_syro_stream(outfile, handle, frame, &options);
+	if (written) printf("ok!\n");
+
+  if (options.progress) fclose(options.progress);
 
   // End conversion
   SyroVolcaSample_End(handle);
 	free_syrodata(syro_data, to_erase_count);
-  printf("ok!\n");
-
-	// Write the output file
-  printf("writing Syro output to %s... ", outfile);
-	if (write_file(outfile, buf_dest, size_dest)) printf("ok!\n");
 
-	free(buf_dest);
-	return 0;
+	return written ? 0 : 1;
 }
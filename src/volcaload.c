@@ -24,9 +24,19 @@
 #include <unistd.h>
 #include <string.h>
 #include <libgen.h>
+#include <sys/stat.h>
 
 #include "korg/korg_syro_volcasample.h"
 #include "volcautils.h"
+#include "volcapcm.h"
+#include "volcaresample.h"
+#include "volcatrim.h"
+#include "volcaplan.h"
+#include "volcastate.h"
+#include "volcacache.h"
+
+// Samples, or their erasing, and patterns, in a single stream
+#define ENTRIES_MAX (VOLCASAMPLE_NUM_OF_SAMPLE + VOLCASAMPLE_NUM_OF_PATTERN)
 
 
 // ----------------------------------------
@@ -47,23 +57,53 @@ void print_samples_to_load(bool to_load[]) {
 }
 
 // ----------------------------------------
-// Load a single sample file into a buffer
+// Release the source of a sample, mapped or streamed
 // ----------------------------------------
-static int load_sample(char *filename, SyroData *syro_data, bool *to_load) {
-
-	uint8_t *src, *poss;
-	uint16_t channel_count, sample_byte, bit_depth;
-  int16_t *posd;
-	uint32_t wav_pos, wav_frames, frame_count, file_size, payload_size;
-  int32_t data, datf;
-  int sample_number;
-
-  printf("loading %s... ", basename(filename));
+static void release_source(uint8_t *src, uint32_t size, bool streamed) {
+  if (streamed) free(src);
+  else unmap_file(src, size);
+}
 
-  // Validate file name
-  if (sscanf(basename(filename), "%d", &sample_number) != 1) {
-    printf("error! can't parse sample number\n");
-    return 0;
+// ----------------------------------------
+// Load a single sample file into a buffer
+//
+// Mono 16 bit samples are used in place from the mapped file, which is
+// then returned in *pmap to be unmapped after the conversion. Otherwise
+// *pmap is set to NULL.
+//
+// Pipes and stdin ("-") are read chunk by chunk instead of mapped. Their
+// sample number can be given as NUMBER:FILE, e.g., 5:- or 12:/dev/fd/3
+//
+// Samples above resample_fs Hz are resampled down to it, unless it is 0,
+// and then trimmed as set in trim (see volcatrim.c)
+// ----------------------------------------
+static int load_sample(char *filename, SyroData *syro_data, bool *to_load,
+                       uint8_t **pmap, uint32_t *pmap_size, uint32_t resample_fs,
+                       trim_options *trim) {
+
+	uint8_t *src;
+	int16_t *frames, *resampled, *copy;
+	int16_t offset = 0;
+	uint32_t frame_count, file_size = 0, payload_size, start, trimmed_size = 0;
+  uint32_t stream_frames = 0;
+  SyroData before;
+  int sample_number, name_pos = 0;
+  bool streamed;
+  wav_info wav;
+  struct stat st;
+
+  // Take the sample number either from a NUMBER: prefix or the file name
+  if (sscanf(filename, "%d:%n", &sample_number, &name_pos) == 1 && name_pos) {
+    filename += name_pos;
+    printf("loading %s... ", basename(filename));
+  } else {
+    printf("loading %s... ", basename(filename));
+
+    // Validate file name
+    if (sscanf(basename(filename), "%d", &sample_number) != 1) {
+      printf("error! can't parse sample number\n");
+      return 0;
+    }
   }
 
   if (!VALID(sample_number)) {
@@ -71,118 +111,390 @@ static int load_sample(char *filename, SyroData *syro_data, bool *to_load) {
     return 0;
   }
 
-  // Read the file contents
-  src = read_file(filename, &file_size);
-	if (!src) return 0;
+  *pmap = NULL;
 
-  // Validate header
-	if (file_size <= sizeof(wav_header)) {
-		printf("error! header too small\n");
-		free(src);
-		return 0;
-	}
-
-	if (memcmp(src, wav_header, 4)) {
-		printf("error! missing 'RIFF' header\n");
-		free(src);
-		return 0;
-	}
-
-	if (memcmp(src + WAV_POS_WAVEFMT, wav_header + WAV_POS_WAVEFMT, 8)) {
-		printf("error! missing 'WAVE' or 'fmt ' header\n");
-		free(src);
-		return 0;
-	}
-
-	wav_pos = WAV_POS_WAVEFMT + 4;
-
-	if (get_16bit_value(src + wav_pos + 8 + WAVFMT_POS_ENCODE) != 1) {
-		printf("error! bad encoding bit\n");
-		free(src);
-		return 0;
-	}
+  // Pipes and stdin can't be mapped
+  streamed = !strcmp(filename, "-")
+    || (stat(filename, &st) == 0 && !S_ISREG(st.st_mode));
 
-	channel_count = get_16bit_value(src + wav_pos + 8 + WAVFMT_POS_CHANNEL);
-	if ((channel_count != 1) && (channel_count != 2)) {
-		printf("error! too many channels: %d (max=2)\n", channel_count);
-		free(src);
-		return 0;
-	}
+  if (streamed) {
+    src = read_wav_stream(filename, &wav);
+    if (!src) return 0;
+  } else {
+    src = map_file(filename, &file_size);
+    if (!src) return 0;
 
+    if (!parse_wav(src, file_size, &wav)) {
+      unmap_file(src, file_size);
+      return 0;
+    }
+  }
 
-  bit_depth = get_16bit_value(src + wav_pos + 8 + WAVFMT_POS_BIT);
-  if ((bit_depth != 16) && (bit_depth != 24)) {
-    printf("error! invalid bit depth: %d (supported: 16,24)\n", bit_depth);
-    free(src);
+  // Validate format
+  if (!pcm_supported(&wav)) {
+    release_source(src, file_size, streamed);
     return 0;
   }
 
-  sample_byte = bit_depth / 8;
-	wav_frames = get_32bit_value(src + wav_pos + 8 + WAVFMT_POS_FS);
-
-  while (true) {
-    payload_size = get_32bit_value(src + wav_pos + 4);
-		if (!memcmp(src + wav_pos, "data", 4)) break;
-
-		wav_pos += payload_size + 8;
-		if (wav_pos + 8 > file_size) {
-			printf("error! missing 'data' header\n");
-			free(src);
-			return 0;
-		}
-	}
+	frame_count = pcm_frame_count(&wav);
+	payload_size = frame_count * 2;
 
-	if (!payload_size) {
+	if (!frame_count) {
 		printf("error! empty payload\n");
-		free(src);
+		release_source(src, file_size, streamed);
 		return 0;
 	}
 
-	if (wav_pos + payload_size + 8 > file_size) {
-		printf("error! payload size mismatch\n");
-		free(src);
-		return 0;
-	}
+  if (pcm_is_mono16(&wav)) {
 
-	// Allocate memory for the new payload
-	frame_count = payload_size  / (channel_count * sample_byte);
-	payload_size = frame_count * 2;
-	syro_data->pData = malloc(payload_size);
+    // Already 1ch, 16bits: use the frames straight from the source
+    frames = (int16_t *) wav.data;
 
-	// Convert to 1ch, 16bits
-  poss = src + wav_pos + 8;
-  posd = (int16_t *) syro_data->pData;
+  } else {
 
-  do {
+    // Convert to 1ch, 16bits into a new payload
+    frames = malloc(payload_size);
+    if (!frames) {
+      printf("error! not enough memory\n");
+      release_source(src, file_size, streamed);
+      return 0;
+    }
+    pcm_to_mono16(&wav, frames);
 
-    datf = 0;
-    for (int ch = 0; ch < channel_count; ch++) {
+    release_source(src, file_size, streamed);
+    src = NULL;
+  }
 
-      data = ((int8_t *) poss)[sample_byte - 1];
-      for (int sbyte = 1; sbyte < sample_byte; sbyte++) {
-        data <<= 8;
-        data |= poss[sample_byte-1-sbyte];
+  // Bring the sample down to the requested rate
+  if (resample_fs && wav.fs > resample_fs) {
+    resampled = resample_mono16(frames, frame_count, wav.fs, resample_fs,
+                                &frame_count);
+    if (src) release_source(src, file_size, streamed);
+    else free(frames);
+    src = NULL;
+
+    if (!resampled) {
+      printf("error! not enough memory\n");
+      return 0;
+    }
+
+    frames = resampled;
+    wav.fs = resample_fs;
+    payload_size = frame_count * 2;
+  }
+
+  if (trim_enabled(trim)) {
+    before.DataType = DataType_Sample_Liner;
+    before.Size = payload_size;
+    stream_frames = SyroVolcaSample_GetDataFrameSize(&before);
+
+    // The frames still in the mapped file are read only
+    if (trim->dc) offset = trim_dc_offset(frames, frame_count);
+    if (offset && src && !streamed) {
+      copy = malloc(payload_size);
+      if (!copy) {
+        printf("error! not enough memory\n");
+        release_source(src, file_size, streamed);
+        return 0;
       }
-      poss += sample_byte;
-      datf += data;
+      memcpy(copy, frames, payload_size);
+      release_source(src, file_size, streamed);
+      src = NULL;
+      frames = copy;
     }
-    datf /= channel_count;
-    *posd++ = (int16_t) datf;
+    if (offset) trim_remove_dc(frames, frame_count, offset);
+
+    frame_count = trim_mono16(frames, frame_count, wav.fs, trim, &start);
+    if (src && !streamed) frames += start;
+    else if (start) memmove(frames, frames + start, frame_count * 2);
+
+    trimmed_size = payload_size - frame_count * 2;
+    payload_size = frame_count * 2;
 
-  } while (--frame_count);
+    before.Size = payload_size;
+    stream_frames -= SyroVolcaSample_GetDataFrameSize(&before);
+  }
+
+  // Frames still in the mapped file are unmapped after the conversion
+  if (src && !streamed) {
+    *pmap = src;
+    *pmap_size = file_size;
+  }
 
+  syro_data->pData = (uint8_t *) frames;
   syro_data->DataType = DataType_Sample_Liner;
   syro_data->Number = sample_number;
 	syro_data->Size = payload_size;
-	syro_data->Fs = wav_frames;
+	syro_data->Fs = wav.fs;
 	syro_data->SampleEndian = LittleEndian;
   to_load[sample_number] = true;
 
-  free(src);
-  printf("ok! [%d bytes] [N=%02d]\n", payload_size, sample_number);
+  printf("ok! [%d bytes] [%d Hz] [N=%02d]", payload_size, wav.fs, sample_number);
+  if (trimmed_size)
+    printf(" [%d bytes trimmed] [%.2f s saved]", trimmed_size,
+           (double) stream_frames / STREAM_FS);
+  printf("\n");
 	return payload_size;
 }
 
+// ----------------------------------------
+// Load a pattern file, given as pattern:NUMBER:FILE with NUMBER from 0 to
+// 9. The file holds the pattern as stored by the Volca Sample, i.e.,
+// VOLCASAMPLE_PATTERN_SIZE bytes
+// ----------------------------------------
+static int load_pattern(char *arg, SyroData *syro_data) {
+
+  uint8_t *data;
+  uint32_t size;
+  int pattern_number, name_pos = 0;
+
+  if (sscanf(arg, "%d:%n", &pattern_number, &name_pos) != 1 || !name_pos) {
+    printf("loading pattern %s... error! can't parse pattern number\n", arg);
+    return 0;
+  }
+
+  printf("loading pattern %s... ", basename(arg + name_pos));
+
+  if (pattern_number < 0 || pattern_number >= VOLCASAMPLE_NUM_OF_PATTERN) {
+    printf("error! pattern number is out of range (0-%d)\n", VOLCASAMPLE_NUM_OF_PATTERN - 1);
+    return 0;
+  }
+
+  data = read_file(arg + name_pos, &size);
+  if (!data) return 0;
+
+  if (size != VOLCASAMPLE_PATTERN_SIZE) {
+    printf("error! a pattern takes %d bytes, not %d\n", VOLCASAMPLE_PATTERN_SIZE, size);
+    free(data);
+    return 0;
+  }
+
+  syro_data->pData = data;
+  syro_data->DataType = DataType_Pattern;
+  syro_data->Number = pattern_number;
+  syro_data->Size = size;
+
+  printf("ok! [%d bytes] [P=%d]\n", size, pattern_number);
+  return 1;
+}
+
+// ----------------------------------------
+// Add the samples to erase and the patterns to the samples to load, so
+// that they all go in a single stream. The erases go first, the ones
+// left by a sync included, so their memory is free before the samples
+// come, and the patterns last. Slots also loaded aren't erased, and
+// neither are the ones already erased. Returns the new number of entries
+// ----------------------------------------
+static int add_entries(SyroData *syro_data, uint8_t **sample_map,
+                       uint32_t *sample_map_size, int samples_count,
+                       bool *to_erase, bool *to_load,
+                       SyroData *patterns, int patterns_count) {
+
+  SyroData data[ENTRIES_MAX];
+  uint8_t *map[ENTRIES_MAX];
+  uint32_t map_size[ENTRIES_MAX];
+  bool erased[VOLCASAMPLE_NUM_OF_SAMPLE] = { false };
+  int count = 0;
+
+  for (int i = 0; i < samples_count; i++) {
+    if (syro_data[i].DataType != DataType_Sample_Erase) continue;
+    erased[syro_data[i].Number] = true;
+    data[count++] = syro_data[i];
+  }
+
+  for (int number = 0; number < VOLCASAMPLE_NUM_OF_SAMPLE; number++) {
+    if (!to_erase[number] || to_load[number] || erased[number]) continue;
+
+    data[count].pData = NULL;
+    data[count].Size = 0;
+    data[count].DataType = DataType_Sample_Erase;
+    data[count].Number = number;
+    count++;
+  }
+
+  for (int i = 0; i < count; i++)
+    map[i] = NULL;
+
+  for (int i = 0; i < samples_count; i++) {
+    if (syro_data[i].DataType == DataType_Sample_Erase) continue;
+    data[count] = syro_data[i];
+    map[count] = sample_map[i];
+    map_size[count] = sample_map_size[i];
+    count++;
+  }
+
+  for (int i = 0; i < patterns_count; i++) {
+    data[count] = patterns[i];
+    map[count] = NULL;
+    count++;
+  }
+
+  memcpy(syro_data, data, count * sizeof(SyroData));
+  memcpy(sample_map, map, count * sizeof(uint8_t *));
+  memcpy(sample_map_size, map_size, count * sizeof(uint32_t));
+  return count;
+}
+
+// ----------------------------------------
+// Release the loaded samples, mapped or allocated
+// ----------------------------------------
+static void free_samples(SyroData *syro_data, uint8_t **sample_map,
+                         uint32_t *sample_map_size, int samples_count) {
+  for (int i = 0; i < samples_count; i++) {
+    if (sample_map[i]) {
+      unmap_file(sample_map[i], sample_map_size[i]);
+      syro_data[i].pData = NULL;
+    }
+  }
+  free_syrodata(syro_data, samples_count);
+}
+
+// ----------------------------------------
+// Send samples compressed when it makes the stream shorter
+// ----------------------------------------
+static void compress_samples(SyroData *syro_data, int samples_count) {
+
+  SyroData compressed;
+  uint32_t liner_frames, comp_frames, saved_frames = 0;
+  int comp_count = 0;
+
+  printf("checking lossless compression... ");
+
+  for (int i = 0; i < samples_count; i++) {
+    if (syro_data[i].DataType != DataType_Sample_Liner) continue;
+
+    compressed = syro_data[i];
+    compressed.DataType = DataType_Sample_Compress;
+    compressed.Quality = 16;
+
+    liner_frames = SyroVolcaSample_GetDataFrameSize(&syro_data[i]);
+    comp_frames = SyroVolcaSample_GetDataFrameSize(&compressed);
+
+    if (comp_frames && comp_frames < liner_frames) {
+      syro_data[i] = compressed;
+      saved_frames += liner_frames - comp_frames;
+      comp_count++;
+    }
+  }
+
+  printf("ok! [%d samples compressed] [%.2f seconds saved]\n",
+         comp_count, (double) saved_frames / STREAM_FS);
+}
+
+// ----------------------------------------
+// Sync with the samples already in the device
+//
+// Samples whose frames, rate and size match the ones recorded in the
+// state are released and dropped from syro_data, and the slots recorded
+// but not in to_load are erased instead. A sample sent below 16 bits is
+// sent again unless lossy is set. The hash of every sample left is kept
+// in hash[] by sample number, and the bytes the unchanged ones take in
+// *resident. Returns the new number of entries
+// ----------------------------------------
+static int sync_samples(SyroData *syro_data, uint8_t **sample_map,
+                        uint32_t *sample_map_size, int samples_count,
+                        bool *to_load, device_state *state, bool lossy,
+                        uint64_t *hash, uint32_t *resident) {
+
+  slot_state *slot;
+  uint64_t sample_hash;
+  int count = 0, unchanged = 0, erased = 0;
+
+  *resident = 0;
+
+  for (int i = 0; i < samples_count; i++) {
+    slot = &state->slot[syro_data[i].Number];
+    sample_hash = state_hash(syro_data[i].pData, syro_data[i].Size);
+
+    if (slot->used && slot->hash == sample_hash && slot->fs == syro_data[i].Fs
+        && slot->size == syro_data[i].Size
+        && (lossy || slot->quality == PLAN_MAX_QUALITY)) {
+      if (sample_map[i]) unmap_file(sample_map[i], sample_map_size[i]);
+      else free(syro_data[i].pData);
+      *resident += syro_data[i].Size;
+      unchanged++;
+      continue;
+    }
+
+    hash[syro_data[i].Number] = sample_hash;
+    syro_data[count] = syro_data[i];
+    sample_map[count] = sample_map[i];
+    sample_map_size[count] = sample_map_size[i];
+    count++;
+  }
+
+  for (int number = 0; number < STATE_SLOTS; number++) {
+    if (!state->slot[number].used || to_load[number]) continue;
+
+    syro_data[count].pData = NULL;
+    syro_data[count].Size = 0;
+    syro_data[count].DataType = DataType_Sample_Erase;
+    syro_data[count].Number = number;
+    sample_map[count] = NULL;
+    count++;
+    erased++;
+  }
+
+  printf("ok! [%d samples unchanged] [%d samples to erase]\n", unchanged, erased);
+  return count;
+}
+
+// ----------------------------------------
+// Record what the stream just written leaves in the device
+// ----------------------------------------
+static void update_state(device_state *state, SyroData *syro_data,
+                         int samples_count, uint64_t *hash) {
+
+  slot_state *slot;
+
+  for (int i = 0; i < samples_count; i++) {
+    if (syro_data[i].DataType == DataType_Pattern) continue;
+
+    slot = &state->slot[syro_data[i].Number];
+    slot->used = syro_data[i].DataType != DataType_Sample_Erase;
+    if (!slot->used) continue;
+
+    slot->hash = hash[syro_data[i].Number];
+    slot->fs = syro_data[i].Fs;
+    slot->size = syro_data[i].Size;
+    slot->quality = syro_data[i].DataType == DataType_Sample_Compress
+      ? (int) syro_data[i].Quality : PLAN_MAX_QUALITY;
+  }
+}
+
+// ----------------------------------------
+// Choose the compression quality of each sample to meet the budgets
+// ----------------------------------------
+static int plan_samples(SyroData *syro_data, int samples_count, plan_budget *budget) {
+
+  plan_result result;
+
+  printf("planning compression quality... ");
+
+  if (!plan_quality(syro_data, samples_count, budget, &result)) {
+    printf("error! not enough memory\n");
+    return 0;
+  }
+
+  if (result.fits) printf("ok! ");
+  else printf("error! budget can't be met ");
+
+  printf("[%d samples reduced] [%d bits lost] [%.2f seconds] [~%.2f%% memory]\n",
+         result.reduced, result.loss, (double) result.frames / STREAM_FS,
+         (100.0 * result.memory) / DEVICE_MEMORY);
+
+  for (int i = 0; i < samples_count; i++) {
+    if (syro_data[i].DataType == DataType_Sample_Compress
+        && syro_data[i].Quality < PLAN_MAX_QUALITY)
+      printf("  sample %02d sent at %d bits\n", syro_data[i].Number, syro_data[i].Quality);
+  }
+
+  if (budget->memory && result.memory > budget->memory)
+    printf("samples need %d bytes of memory, try a lower rate with -r\n", result.memory);
+
+  return result.fits;
+}
+
 // ----------------------------------------
 // Print usage message
 // ----------------------------------------
@@ -193,13 +505,52 @@ static void print_usage(char *bin) {
     "\n"
     "\nSample names must begin with a number from 0 to 99 to be used as"
     "\nthe sample number, e.g., 001_kick.wav, 02-fx.wav, 5-hihat.wav"
+    "\nor be prefixed with one, e.g., 5:kick.wav. Use - to read a sample"
+    "\nfrom stdin, e.g., ffmpeg -i kick.mp3 -f wav - | %s 5:-"
+    "\n"
+    "\nSamples can be erased in the same stream with erase:NUMBER or"
+    "\nerase:FIRST-LAST, e.g., erase:10-19, and patterns loaded with"
+    "\npattern:NUMBER:FILE, NUMBER from 0 to 9, e.g., pattern:0:beat.vpat"
     "\n"
     "\nOptional arguments:"
-    "\n  -o FILE     specify the output file name (default: \"syro.wav\")"
+    "\n  -o FILE     specify the output file name (default: \"syro.wav\"), use -"
+    "\n              to stream to stdout, e.g., %s -o - ... | aplay"
+    "\n  -f FORMAT   output format: wav (default) or raw, i.e., S16_LE stereo"
+    "\n              at 44100 Hz without header"
+    "\n  -p FILE     write the progress to FILE as it is sent, one line of"
+    "\n              \"FRAMES_SENT FRAMES SAMPLE_NUMBER\" every 0.1 seconds"
+    "\n              (see volcaflash -p)"
+    "\n  -b CHUNKS   generate and write the stream on separate threads, through"
+    "\n              a ring of CHUNKS x 64 KB, e.g., 16"
+    "\n  -r FS       resample samples above FS Hz down to FS, e.g., 31250"
+    "\n              (the native rate of the Volca Sample) for a shorter stream"
+    "\n  -z DB       trim the silence below DB dBFS at both ends of the samples,"
+    "\n              e.g., -60"
+    "\n  -x          remove the DC offset of the samples"
+    "\n  -e MS       cut up to MS milliseconds off the end of the samples, at a"
+    "\n              zero crossing, when that saves an erase gap (~0.18 s) in"
+    "\n              the stream, every %d frames of a sample"
+    "\n  -c          compress samples (lossless) when it shortens the stream"
+    "\n  -m BYTES    device memory the samples must fit in, e.g., %d (all of it)"
+    "\n  -d SECONDS  longest stream allowed, the quality of the samples is"
+    "\n              lowered (down to %d bits) as little as needed to meet it."
+    "\n              Either -m or -d replaces -c"
+    "\n  -s STATE    only send the samples that changed since the last run,"
+    "\n              and erase the ones no longer given, as recorded in STATE"
+    "\n              (created if missing). STATE is updated once the output"
+    "\n              is written, so play it before the next run. If nothing"
+    "\n              changed, no output is written and the exit status is 0"
+    "\n  -k DIR      keep the compressed samples in DIR, block by block, so"
+    "\n              the blocks that didn't change aren't compressed again,"
+    "\n              nor sized again when planning -c, -m or -d"
+    "\n  -g DIR      keep the stream rendered for each sample in DIR, so the"
+    "\n              samples sent before in the same way aren't rendered again"
+    "\n  -n          dry run: print how long the stream takes, data by data, and"
+    "\n              the memory the samples take, without writing it"
     "\n  -t          print a table with the samples to modify"
     "\n  -h          print this help message"
     "\n",
-    bin);
+    bin, bin, bin, TRIM_GAP_FRAMES, DEVICE_MEMORY, PLAN_MIN_QUALITY);
 }
 
 // ----------------------------------------
@@ -207,26 +558,117 @@ static void print_usage(char *bin) {
 // ----------------------------------------
 int main(int argc, char **argv) {
 
-	SyroData syro_data[100];
+	SyroData syro_data[ENTRIES_MAX];
 	SyroData *syro_data_ptr = syro_data;
+  SyroData patterns[VOLCASAMPLE_NUM_OF_PATTERN];
 	SyroStatus status;
 	SyroHandle handle;
-	uint8_t *buf_dest;
-	int16_t left, right;
-	uint32_t size_dest, frame, write_pos;
+	uint32_t frame;
+	int written;
 	int samples_count = 0, tot_samples_bytes = 0;
+  int erase_count = 0, patterns_count = 0;
+  uint8_t *sample_map[ENTRIES_MAX];
+  uint32_t sample_map_size[ENTRIES_MAX];
   bool to_load[100] = { false };
+  bool to_erase[100] = { false };
   bool print_table = false;
+  bool dry_run = false;
+  bool planned = true;
+  bool compress = false;
+  uint32_t resample_fs = 0;
+  trim_options trim = { 0, false, 0 };
+  plan_budget budget = { 0, 0, 0 };
+  char *state_file = NULL;
+  device_state state;
+  uint64_t hash[STATE_SLOTS];
+  char *cache_dir = NULL;
+  block_cache cache;
+  char *segment_dir = NULL;
+  segment_cache segments;
 
   // Parse command line options
   int opt;
   char *outfile = "syro.wav";
+  char *progress_file = NULL;
+  stream_options options = { false, NULL, NULL, NULL };
+  int ring_count = 0;
+  ring stream_ring;
 
-  while ((opt = getopt (argc, argv, "o:th")) != -1){
+  while ((opt = getopt (argc, argv, "o:f:b:p:r:z:e:m:d:s:k:g:xncth")) != -1){
     switch (opt) {
     case 'o':
       outfile = optarg;
       break;
+    case 'f':
+      if (strcmp(optarg, "wav") && strcmp(optarg, "raw")) {
+        print_usage(argv[0]);
+        return 1;
+      }
+      options.raw = !strcmp(optarg, "raw");
+      break;
+    case 'p':
+      progress_file = optarg;
+      break;
+    case 'b':
+      ring_count = atoi(optarg);
+      if (ring_count < 1 || ring_count > RING_MAX_COUNT) {
+        printf("error! invalid ring size: %s (1-%d)\n", optarg, RING_MAX_COUNT);
+        return 1;
+      }
+      break;
+    case 'r':
+      if (atoi(optarg) <= 0) {
+        printf("error! invalid sample rate: %s\n", optarg);
+        return 1;
+      }
+      resample_fs = atoi(optarg);
+      break;
+    case 'z':
+      if (atof(optarg) >= 0) {
+        printf("error! invalid silence level: %s\n", optarg);
+        return 1;
+      }
+      trim.threshold = trim_threshold(atof(optarg));
+      break;
+    case 'x':
+      trim.dc = true;
+      break;
+    case 'e':
+      if (atoi(optarg) <= 0) {
+        printf("error! invalid snap length: %s\n", optarg);
+        return 1;
+      }
+      trim.snap_ms = atoi(optarg);
+      break;
+    case 'c':
+      compress = true;
+      break;
+    case 'm':
+      if (atoi(optarg) <= 0) {
+        printf("error! invalid memory budget: %s\n", optarg);
+        return 1;
+      }
+      budget.memory = atoi(optarg);
+      break;
+    case 'd':
+      if (atof(optarg) <= 0) {
+        printf("error! invalid stream duration: %s\n", optarg);
+        return 1;
+      }
+      budget.frames = (uint32_t) (atof(optarg) * STREAM_FS);
+      break;
+    case 's':
+      state_file = optarg;
+      break;
+    case 'k':
+      cache_dir = optarg;
+      break;
+    case 'g':
+      segment_dir = optarg;
+      break;
+    case 'n':
+      dry_run = true;
+      break;
     case 't':
       print_table = true;
       break;
@@ -237,68 +679,183 @@ int main(int argc, char **argv) {
     }
   }
 
+  // Keep stdout for the stream
+  if (!strcmp(outfile, "-")) redirect_messages();
+
   // Load each command line sample into the buffer
   for (int sample_arg = optind; sample_arg < argc; sample_arg++) {
 
     char *sample_path = argv[sample_arg];
-    int sample_bytes;
+    int sample_bytes, first, last;
+
+    // Samples to erase and patterns go along with the samples. Unlike a
+    // sample, a wrong one stops everything, the device would be left
+    // different from what was asked
+    if (!strncmp(sample_path, "erase:", 6)) {
+      if (!parse_sample_range(sample_path + 6, &first, &last)) {
+        printf("error! invalid erase interval: %s\n", sample_path + 6);
+        free_samples(syro_data, sample_map, sample_map_size, samples_count);
+        free_syrodata(patterns, patterns_count);
+        return 1;
+      }
+      for (int i = first; i <= last; i++) to_erase[i] = true;
+      continue;
+    }
+
+    if (!strncmp(sample_path, "pattern:", 8)) {
+      if (patterns_count == VOLCASAMPLE_NUM_OF_PATTERN) {
+        printf("error! too many patterns: %s (%d at most)\n", sample_path + 8,
+               VOLCASAMPLE_NUM_OF_PATTERN);
+      } else if (load_pattern(sample_path + 8, &patterns[patterns_count])) {
+        patterns_count++;
+        continue;
+      }
+      free_samples(syro_data, sample_map, sample_map_size, samples_count);
+      free_syrodata(patterns, patterns_count);
+      return 1;
+    }
 
     // Try loading the wav frames into the buffer
-    if ((sample_bytes = load_sample(sample_path, syro_data_ptr, to_load))) {
+    if ((sample_bytes = load_sample(sample_path, syro_data_ptr, to_load,
+                                    &sample_map[samples_count],
+                                    &sample_map_size[samples_count],
+                                    resample_fs, &trim))) {
       syro_data_ptr++;
       samples_count++;
       tot_samples_bytes += sample_bytes;
     }
   }
 
-	if (samples_count) {
-    printf("found %d samples to load [%d bytes] [~%.2f%% memory]\n",
-           samples_count, tot_samples_bytes,
-           (100.0 * tot_samples_bytes) / 4194304);
+  // Loaded slots are overwritten anyway
+  for (int i = 0; i < 100; i++) {
+    to_erase[i] = to_erase[i] && !to_load[i];
+    if (to_erase[i]) erase_count++;
+  }
+
+	if (samples_count || erase_count || patterns_count) {
+    if (samples_count)
+      printf("found %d samples to load [%d bytes] [~%.2f%% memory]\n",
+             samples_count, tot_samples_bytes,
+             (100.0 * tot_samples_bytes) / DEVICE_MEMORY);
+    if (erase_count || patterns_count)
+      printf("found %d samples to erase [%d patterns to load]\n",
+             erase_count, patterns_count);
     if (print_table) print_samples_to_load(to_load);
 	} else {
 		printf("nothing to load here\n");
 		return 1;
   }
 
+  if (cache_dir && !cache_open(&cache, cache_dir)) {
+    free_samples(syro_data, sample_map, sample_map_size, samples_count);
+    free_syrodata(patterns, patterns_count);
+    return 1;
+  }
+
+  if (state_file) {
+    printf("syncing with %s... ", state_file);
+    if (!state_read(state_file, &state)) {
+      if (cache_dir) cache_close(&cache);
+      free_samples(syro_data, sample_map, sample_map_size, samples_count);
+      free_syrodata(patterns, patterns_count);
+      return 1;
+    }
+
+    samples_count = sync_samples(syro_data, sample_map, sample_map_size,
+                                 samples_count, to_load, &state,
+                                 budget.frames != 0, hash, &budget.resident);
+  }
+
+  samples_count = add_entries(syro_data, sample_map, sample_map_size, samples_count,
+                              to_erase, to_load, patterns, patterns_count);
+
+  // Nothing to send, the progress file is still closed so a reader sees
+  // the end of it
+  if (!samples_count) {
+    printf("the device is up to date\n");
+    if (cache_dir) cache_close(&cache);
+    if (progress_file && (options.progress = open_progress(progress_file)))
+      fclose(options.progress);
+    return 0;
+  }
+
+  if (budget.memory || budget.frames) {
+    planned = plan_samples(syro_data, samples_count, &budget);
+
+    // A dry run still shows the stream that misses the budget
+    if (!planned && !dry_run) {
+      if (cache_dir) cache_close(&cache);
+      free_samples(syro_data, sample_map, sample_map_size, samples_count);
+      return 1;
+    }
+  } else if (compress) {
+    compress_samples(syro_data, samples_count);
+  }
+
+  if (dry_run) {
+    written = plan_dry_run(syro_data, samples_count, budget.resident);
+    if (cache_dir) cache_close(&cache);
+    free_samples(syro_data, sample_map, sample_map_size, samples_count);
+    return written && planned ? 0 : 1;
+  }
+
   // Start conversion
   printf("starting Syro stream conversion... ");
-  status = SyroVolcaSample_Start(&handle, syro_data, samples_count, 0, &frame);
+  status = SyroVolcaSample_Start(&handle, syro_data, samples_count,
+                                 SYRO_FLAG_PARALLEL_COMPRESS, &frame);
 	if (status != Status_Success) {
 		printf("error starting conversion: %d\n", status);
-		free_syrodata(syro_data, samples_count);
+		if (cache_dir) cache_close(&cache);
+		free_samples(syro_data, sample_map, sample_map_size, samples_count);
 		return 1;
 	}
 
-  // Allocate memory for the output file
-	size_dest = frame * 4 + sizeof(wav_header);
-	buf_dest = malloc(size_dest);
-
-  // Copy the wav header to the output file
-	memcpy(buf_dest, wav_header, sizeof(wav_header));
-	set_32bit_value(buf_dest + WAV_POS_RIFF_SIZE, frame * 4 + 0x24);
-	set_32bit_value(buf_dest + WAV_POS_DATA_SIZE, frame * 4);
-
-	// Get each converted sample from the SDK
-	write_pos = sizeof(wav_header);
-	while (frame) {
-		SyroVolcaSample_GetSample(handle, &left, &right);
-		buf_dest[write_pos++] = (uint8_t) left;
-		buf_dest[write_pos++] = (uint8_t) (left >> 8);
-		buf_dest[write_pos++] = (uint8_t) right;
-		buf_dest[write_pos++] = (uint8_t) (right >> 8);
-		frame--;
-	}
+  if (cache_dir) {
+    printf("ok! [%d blocks compressed] [%d blocks read from cache]\n",
+           atomic_load(&cache.stored), atomic_load(&cache.loaded));
+    cache_close(&cache);
+  } else {
+    printf("ok!\n");
+  }
+
+	// Convert and write the output file one chunk at a time
+  if (ring_count && !ring_init(&stream_ring, ring_count)) {
+    printf("error! not enough memory for the ring\n");
+    ring_count = 0;
+  }
+
+  if (ring_count) options.pring = &stream_ring;
+  if (segment_dir && segment_open(&segments, segment_dir, syro_data, samples_count))
+    options.segments = &segments;
+  if (progress_file) options.progress = open_progress(progress_file);
+
+  printf("writing Syro output to %s... ", strcmp(outfile, "-") ? outfile : "stdout");
+	written = write_syro_stream(outfile, handle, frame, &options);
+
+  if (written && ring_count) {
+    printf("ok! [%d generator stalls] [%d writer stalls]\n",
+           stream_ring.full_stalls, stream_ring.empty_stalls);
+  } else if (written) {
+    printf("ok!\n");
+  }
+
+  if (written && options.segments) {
+    printf("reused %d stream segments, kept %d new ones\n",
+           segments.spliced, segments.recorded);
+  }
+
+  if (written && state_file) {
+    update_state(&state, syro_data, samples_count, hash);
+    if (!state_write(state_file, &state)) written = 0;
+  }
+
+  if (ring_count) ring_free(&stream_ring);
+  if (options.segments) segment_close(&segments);
+  if (options.progress) fclose(options.progress);
 
   // End conversion
   SyroVolcaSample_End(handle);
-	free_syrodata(syro_data, samples_count);
-  printf("ok!\n");
-
-	// Write the output file
-  printf("writing Syro output to %s... ", outfile);
-	if (write_file(outfile, buf_dest, size_dest)) printf("ok!\n");
+	free_samples(syro_data, sample_map, sample_map_size, samples_count);
 
-	free(buf_dest);
-	return 0;
+	return written ? 0 : 1;
 }
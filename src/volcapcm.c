@@ -0,0 +1,331 @@
+// ----------------------------------------
+//  PCM format conversion to mono 16 bit
+// ----------------------------------------
+//
+//  Every input sample is first scaled to 16 bits (8 bit is unsigned,
+//  24/32 bit keep their top 16 bits, float is clipped and rounded to
+//  the nearest value). The channels are then downmixed with equal
+//  weights, except for the LFE channel of WAVE_FORMAT_EXTENSIBLE files
+//  which is left out. The mix is truncated toward zero, so 16 bit
+//  stereo gives (L + R) / 2 exactly as C computes it.
+//
+//  Stereo in every bit depth has SSE2 kernels, every other layout goes
+//  through the scalar one. Both give the same result. 24 bit samples
+//  are taken as the 32 bits starting at them (left) or ending with them
+//  (right), both inside the 24 bytes of 4 frames, and shifted into place.
+// ----------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "volcapcm.h"
+
+// ----------------------------------------
+// Format checks
+// ----------------------------------------
+int pcm_supported(wav_info *wav) {
+
+	if (wav->encoding != WAVE_FORMAT_PCM && wav->encoding != WAVE_FORMAT_IEEE_FLOAT) {
+		printf("error! bad encoding: 0x%04x (supported: PCM, float)\n", wav->encoding);
+		return 0;
+	}
+
+	if (!wav->channel_count || wav->channel_count > PCM_MAX_CHANNELS) {
+		printf("error! invalid channel count: %d (max=%d)\n",
+		       wav->channel_count, PCM_MAX_CHANNELS);
+		return 0;
+	}
+
+	if (wav->encoding == WAVE_FORMAT_IEEE_FLOAT && wav->bit_depth != 32) {
+		printf("error! invalid float bit depth: %d (supported: 32)\n", wav->bit_depth);
+		return 0;
+	}
+
+	if (wav->bit_depth != 8 && wav->bit_depth != 16 &&
+	    wav->bit_depth != 24 && wav->bit_depth != 32) {
+		printf("error! invalid bit depth: %d (supported: 8,16,24,32)\n", wav->bit_depth);
+		return 0;
+	}
+
+	return 1;
+}
+
+uint32_t pcm_frame_count(wav_info *wav) {
+	return wav->data_size / (wav->channel_count * (wav->bit_depth / 8));
+}
+
+bool pcm_is_mono16(wav_info *wav) {
+	return wav->encoding == WAVE_FORMAT_PCM
+	    && wav->channel_count == 1
+	    && wav->bit_depth == 16;
+}
+
+// ----------------------------------------
+// Single sample decoding, scaled to 16 bits
+// ----------------------------------------
+static inline int32_t pcm_float_to_16(float data) {
+	data *= 32768.0f;
+	data = data < 32767.0f ? data : 32767.0f;
+	data = data > -32768.0f ? data : -32768.0f;
+	return (int32_t) lrintf(data);
+}
+
+static inline int32_t pcm_decode(uint8_t *ptr, uint16_t encoding, uint16_t sample_byte) {
+
+	union { uint32_t u; float f; } bits;
+
+	switch (sample_byte) {
+	case 1:
+		return ((int32_t) ptr[0] - 128) << 8;
+	case 2:
+		return (int16_t) get_16bit_value(ptr);
+	case 3:
+		return (int16_t) get_16bit_value(ptr + 1);
+	default:
+		bits.u = get_32bit_value(ptr);
+		if (encoding == WAVE_FORMAT_IEEE_FLOAT) return pcm_float_to_16(bits.f);
+		return (int16_t) (bits.u >> 16);
+	}
+}
+
+// ----------------------------------------
+// Downmix weights: every channel but LFE counts the same
+// ----------------------------------------
+static int pcm_mix_channels(wav_info *wav, bool *mixed) {
+
+	uint32_t mask = wav->channel_mask;
+	uint32_t speaker;
+	int mixed_count = 0;
+
+	for (int ch = 0; ch < wav->channel_count; ch++) {
+
+		// Channels take the speaker positions set in the mask, in order
+		speaker = mask & -mask;
+		mask &= ~speaker;
+
+		mixed[ch] = speaker != SPEAKER_LOW_FREQUENCY;
+		mixed_count += mixed[ch];
+	}
+
+	// Nothing but LFE, keep it
+	if (!mixed_count) {
+		for (int ch = 0; ch < wav->channel_count; ch++) mixed[ch] = true;
+		mixed_count = wav->channel_count;
+	}
+
+	return mixed_count;
+}
+
+// ----------------------------------------
+// Scalar kernel, any layout
+// ----------------------------------------
+static void pcm_to_mono16_scalar(wav_info *wav, bool *mixed, int mixed_count,
+                                 uint8_t *src, int16_t *dest, uint32_t frame_count) {
+
+	uint16_t sample_byte = wav->bit_depth / 8;
+	uint16_t channel_count = wav->channel_count;
+	int32_t datf;
+
+	while (frame_count--) {
+		datf = 0;
+		for (int ch = 0; ch < channel_count; ch++) {
+			if (mixed[ch]) datf += pcm_decode(src, wav->encoding, sample_byte);
+			src += sample_byte;
+		}
+		*dest++ = (int16_t) (datf / mixed_count);
+	}
+}
+
+#ifdef __SSE2__
+// ----------------------------------------
+// SSE2 kernels, 8 stereo frames at a time
+// ----------------------------------------
+
+// Halve, rounding toward zero
+static inline __m128i pcm_half_sse2(__m128i data) {
+	return _mm_srai_epi32(_mm_add_epi32(data, _mm_srli_epi32(data, 31)), 1);
+}
+
+static uint32_t pcm_u8_stereo_sse2(uint8_t *src, int16_t *dest, uint32_t frame_count) {
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i ones = _mm_set1_epi16(1);
+	__m128i offset = _mm_set1_epi32(256);
+	__m128i data, lo, hi;
+	uint32_t done;
+
+	for (done = 0; done + 8 <= frame_count; done += 8) {
+		// L + R of frames 0-3 and 4-7, still unsigned
+		data = _mm_loadu_si128((__m128i *) src);
+		lo = _mm_madd_epi16(_mm_unpacklo_epi8(data, zero), ones);
+		hi = _mm_madd_epi16(_mm_unpackhi_epi8(data, zero), ones);
+		lo = pcm_half_sse2(_mm_slli_epi32(_mm_sub_epi32(lo, offset), 8));
+		hi = pcm_half_sse2(_mm_slli_epi32(_mm_sub_epi32(hi, offset), 8));
+		_mm_storeu_si128((__m128i *) dest, _mm_packs_epi32(lo, hi));
+		src += 16;
+		dest += 8;
+	}
+
+	return done;
+}
+
+static uint32_t pcm_s16_stereo_sse2(uint8_t *src, int16_t *dest, uint32_t frame_count) {
+
+	__m128i ones = _mm_set1_epi16(1);
+	__m128i lo, hi;
+	uint32_t done;
+
+	for (done = 0; done + 8 <= frame_count; done += 8) {
+		lo = _mm_loadu_si128((__m128i *) src);
+		hi = _mm_loadu_si128((__m128i *) (src + 16));
+		lo = pcm_half_sse2(_mm_madd_epi16(lo, ones));
+		hi = pcm_half_sse2(_mm_madd_epi16(hi, ones));
+		_mm_storeu_si128((__m128i *) dest, _mm_packs_epi32(lo, hi));
+		src += 32;
+		dest += 8;
+	}
+
+	return done;
+}
+
+static inline __m128i pcm_s24_stereo_4_sse2(uint8_t *src) {
+
+	__m128i lo = _mm_loadu_si128((__m128i *) src);
+	__m128i hi = _mm_loadu_si128((__m128i *) (src + 8));
+	__m128i left, right;
+
+	// Left samples at bytes 0, 6, 12 and 18, top 16 bits in bits 8-23
+	left = _mm_unpacklo_epi64(
+		_mm_unpacklo_epi32(lo, _mm_srli_si128(lo, 6)),
+		_mm_unpacklo_epi32(_mm_srli_si128(lo, 12), _mm_srli_si128(hi, 10)));
+
+	// Right samples at bytes 3, 9, 15 and 21, top 16 bits in bits 16-31
+	right = _mm_unpacklo_epi64(
+		_mm_unpacklo_epi32(_mm_srli_si128(lo, 2), _mm_srli_si128(lo, 8)),
+		_mm_unpacklo_epi32(_mm_srli_si128(hi, 6), _mm_srli_si128(hi, 12)));
+
+	left = _mm_srai_epi32(_mm_slli_epi32(left, 8), 16);
+	right = _mm_srai_epi32(right, 16);
+
+	return pcm_half_sse2(_mm_add_epi32(left, right));
+}
+
+static uint32_t pcm_s24_stereo_sse2(uint8_t *src, int16_t *dest, uint32_t frame_count) {
+
+	uint32_t done;
+
+	for (done = 0; done + 8 <= frame_count; done += 8) {
+		_mm_storeu_si128((__m128i *) dest,
+		                 _mm_packs_epi32(pcm_s24_stereo_4_sse2(src),
+		                                 pcm_s24_stereo_4_sse2(src + 24)));
+		src += 48;
+		dest += 8;
+	}
+
+	return done;
+}
+
+static inline __m128i pcm_s32_stereo_4_sse2(uint8_t *src) {
+
+	__m128i ones = _mm_set1_epi16(1);
+	__m128i lo, hi;
+
+	// Top 16 bits of each sample, then L + R
+	lo = _mm_srai_epi32(_mm_loadu_si128((__m128i *) src), 16);
+	hi = _mm_srai_epi32(_mm_loadu_si128((__m128i *) (src + 16)), 16);
+
+	return pcm_half_sse2(_mm_madd_epi16(_mm_packs_epi32(lo, hi), ones));
+}
+
+static uint32_t pcm_s32_stereo_sse2(uint8_t *src, int16_t *dest, uint32_t frame_count) {
+
+	uint32_t done;
+
+	for (done = 0; done + 8 <= frame_count; done += 8) {
+		_mm_storeu_si128((__m128i *) dest,
+		                 _mm_packs_epi32(pcm_s32_stereo_4_sse2(src),
+		                                 pcm_s32_stereo_4_sse2(src + 32)));
+		src += 64;
+		dest += 8;
+	}
+
+	return done;
+}
+
+static inline __m128i pcm_f32_stereo_4_sse2(uint8_t *src) {
+
+	__m128 scale = _mm_set1_ps(32768.0f);
+	__m128 max = _mm_set1_ps(32767.0f);
+	__m128 min = _mm_set1_ps(-32768.0f);
+	__m128 lo, hi, left, right;
+
+	lo = _mm_loadu_ps((float *) src);
+	hi = _mm_loadu_ps((float *) (src + 16));
+	left = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+	right = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+
+	left = _mm_max_ps(_mm_min_ps(_mm_mul_ps(left, scale), max), min);
+	right = _mm_max_ps(_mm_min_ps(_mm_mul_ps(right, scale), max), min);
+
+	return pcm_half_sse2(_mm_add_epi32(_mm_cvtps_epi32(left), _mm_cvtps_epi32(right)));
+}
+
+static uint32_t pcm_f32_stereo_sse2(uint8_t *src, int16_t *dest, uint32_t frame_count) {
+
+	uint32_t done;
+
+	for (done = 0; done + 8 <= frame_count; done += 8) {
+		_mm_storeu_si128((__m128i *) dest,
+		                 _mm_packs_epi32(pcm_f32_stereo_4_sse2(src),
+		                                 pcm_f32_stereo_4_sse2(src + 32)));
+		src += 64;
+		dest += 8;
+	}
+
+	return done;
+}
+#endif
+
+// ----------------------------------------
+// Convert the whole payload
+// ----------------------------------------
+void pcm_to_mono16(wav_info *wav, int16_t *dest) {
+
+	uint8_t *src = wav->data;
+	uint32_t frame_count = pcm_frame_count(wav);
+	uint32_t frame_byte = wav->channel_count * (wav->bit_depth / 8);
+	uint32_t done = 0;
+	bool mixed[PCM_MAX_CHANNELS];
+	int mixed_count;
+
+	if (pcm_is_mono16(wav)) {
+		memcpy(dest, src, frame_count * 2);
+		return;
+	}
+
+	mixed_count = pcm_mix_channels(wav, mixed);
+
+#ifdef __SSE2__
+	if (wav->channel_count == 2 && mixed_count == 2) {
+		if (wav->encoding == WAVE_FORMAT_IEEE_FLOAT)
+			done = pcm_f32_stereo_sse2(src, dest, frame_count);
+		else if (wav->bit_depth == 8)
+			done = pcm_u8_stereo_sse2(src, dest, frame_count);
+		else if (wav->bit_depth == 16)
+			done = pcm_s16_stereo_sse2(src, dest, frame_count);
+		else if (wav->bit_depth == 24)
+			done = pcm_s24_stereo_sse2(src, dest, frame_count);
+		else
+			done = pcm_s32_stereo_sse2(src, dest, frame_count);
+	}
+#endif
+
+	pcm_to_mono16_scalar(wav, mixed, mixed_count, src + done * frame_byte,
+	                     dest + done, frame_count - done);
+}
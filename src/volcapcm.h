@@ -0,0 +1,23 @@
+// ----------------------------------------
+//  PCM format conversion to mono 16 bit
+// ----------------------------------------
+
+#ifndef __VOLCAPCM_H__
+#define __VOLCAPCM_H__
+
+#include "volcautils.h"
+
+#define SPEAKER_LOW_FREQUENCY  0x08
+
+#define PCM_MAX_CHANNELS 32
+
+// ----------------------------------------
+// Conversion
+// ----------------------------------------
+int      pcm_supported(wav_info *wav);
+uint32_t pcm_frame_count(wav_info *wav);
+bool     pcm_is_mono16(wav_info *wav);
+void     pcm_to_mono16(wav_info *wav, int16_t *dest);
+
+
+#endif  // #ifndef __VOLCAPCM_H__
@@ -0,0 +1,357 @@
+// ----------------------------------------
+//  Compression quality planning under memory and time budgets
+// ----------------------------------------
+//
+//  Each sample can be sent as is or compressed with a quality of 8 to 16
+//  bits, the lower the shorter the stream. The plan starts with every
+//  sample at its shortest lossless form, and while the stream is too long
+//  it lowers the quality of the sample that saves the most frames per bit
+//  given up, looking at every lower quality of it, since the stream is
+//  made of whole blocks and a single bit doesn't always save one. Once
+//  it fits, the bits that are no longer needed are given back, cheapest
+//  first.
+//
+//  The Volca Sample stores every sample as 16 bit PCM whatever quality it
+//  was sent with, so the device memory only depends on the sample
+//  lengths: it is checked, but only resampling can make it fit.
+//
+//  Entries other than samples (erased slots) are sent as they are.
+//
+//  Compressed sizes are only worked out for the lossy qualities if the
+//  lossless plan doesn't fit already, with one job per sample and
+//  quality spread over the cores.
+// ----------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "korg/korg_syro_volcasample.h"
+#include "korg/korg_syro_comp.h"
+#include "korg/korg_syro_thread.h"
+#include "volcaplan.h"
+#include "volcautils.h"
+
+#define PLAN_QUALITIES (PLAN_MAX_QUALITY - PLAN_MIN_QUALITY + 1)
+
+typedef struct {
+	SyroData *syro_data;
+	uint32_t *frames;    // PLAN_QUALITIES per sample, compressed
+	int first;           // quality of job 0 of each sample
+	int count;           // qualities per sample in this run
+	atomic_bool failed;  // set by any of the workers
+} plan_jobs;
+
+// Erased slots and the like can't be compressed
+static inline bool plan_fixed(SyroData *data) {
+	return data->DataType != DataType_Sample_Liner && data->DataType != DataType_Sample_Compress;
+}
+
+// Frames of a single sample compressed at a single quality
+static void plan_job(void *param, int index) {
+
+	plan_jobs *jobs = param;
+	int sample = index / jobs->count;
+	int quality = jobs->first + index % jobs->count;
+	SyroData *data = &jobs->syro_data[sample];
+	uint32_t *frames = &jobs->frames[sample * PLAN_QUALITIES + quality - PLAN_MIN_QUALITY];
+	uint32_t comp_size;
+
+	if (plan_fixed(data)) {
+		*frames = SyroVolcaSample_GetDataFrameSize(data);
+		return;
+	}
+
+	comp_size = SyroComp_GetCompSize(data->pData, data->Size / 2, quality, data->SampleEndian);
+	if (!comp_size) atomic_store(&jobs->failed, true);
+
+	*frames = SyroVolcaSample_GetCompFrameSize(data, comp_size);
+}
+
+static int plan_sizes(plan_jobs *jobs, int samples_count, int first, int count) {
+	jobs->first = first;
+	jobs->count = count;
+	SyroThread_Run(plan_job, jobs, samples_count * count, SyroThread_GetNumOfThread());
+	return !atomic_load(&jobs->failed);
+}
+
+// Frames of a sample at a quality, sent as is if shorter at 16 bits
+static inline uint32_t plan_frames(uint32_t *frames, uint32_t *liner, int sample, int quality) {
+
+	uint32_t comp = frames[sample * PLAN_QUALITIES + quality - PLAN_MIN_QUALITY];
+
+	return quality == PLAN_MAX_QUALITY && liner[sample] <= comp ? liner[sample] : comp;
+}
+
+// Lower qualities while the stream is too long, the most frames saved
+// per bit first
+static void plan_lower(uint32_t *frames, uint32_t *liner, int *quality,
+                       int samples_count, uint32_t budget, uint32_t *ptotal) {
+
+	uint32_t current, saved, best_saved;
+	int best, best_quality;
+	double ratio, best_ratio;
+
+	while (*ptotal > budget) {
+		best = -1;
+		best_ratio = 0;
+		best_saved = 0;
+		best_quality = 0;
+
+		for (int i = 0; i < samples_count; i++) {
+			current = plan_frames(frames, liner, i, quality[i]);
+
+			for (int q = quality[i] - 1; q >= PLAN_MIN_QUALITY; q--) {
+				if (plan_frames(frames, liner, i, q) >= current) continue;
+
+				saved = current - plan_frames(frames, liner, i, q);
+				ratio = (double) saved / (quality[i] - q);
+				if (ratio > best_ratio || (ratio == best_ratio && saved > best_saved)) {
+					best = i;
+					best_ratio = ratio;
+					best_saved = saved;
+					best_quality = q;
+				}
+			}
+		}
+
+		// Every sample is as short as it gets
+		if (best < 0) return;
+
+		quality[best] = best_quality;
+		*ptotal -= best_saved;
+	}
+}
+
+// Raise qualities back while the stream still fits, the fewest frames
+// added per bit first
+static void plan_raise(uint32_t *frames, uint32_t *liner, int *quality,
+                       int samples_count, uint32_t budget, uint32_t *ptotal) {
+
+	uint32_t current, added, best_added;
+	int best, best_quality;
+	double ratio, best_ratio;
+
+	for (;;) {
+		best = -1;
+		best_ratio = 0;
+		best_added = 0;
+		best_quality = 0;
+
+		for (int i = 0; i < samples_count; i++) {
+			current = plan_frames(frames, liner, i, quality[i]);
+
+			for (int q = quality[i] + 1; q <= PLAN_MAX_QUALITY; q++) {
+				added = plan_frames(frames, liner, i, q) > current
+					? plan_frames(frames, liner, i, q) - current : 0;
+				if (*ptotal + added > budget) continue;
+
+				ratio = (double) added / (q - quality[i]);
+				if (best < 0 || ratio < best_ratio) {
+					best = i;
+					best_ratio = ratio;
+					best_added = added;
+					best_quality = q;
+				}
+			}
+		}
+
+		if (best < 0) return;
+
+		quality[best] = best_quality;
+		*ptotal += best_added;
+	}
+}
+
+// ----------------------------------------
+// Choose how to send each sample so that both budgets are met, losing
+// as few bits as possible. The data type and quality of syro_data are
+// set in place, the totals are returned in *result
+// ----------------------------------------
+int plan_quality(SyroData *syro_data, int samples_count, plan_budget *budget,
+                 plan_result *result) {
+
+	plan_jobs jobs = { syro_data, NULL, 0, 0 };
+	uint32_t *liner;
+	uint32_t total;
+	int *quality;
+	int ok = 1;
+
+	atomic_init(&jobs.failed, false);
+	jobs.frames = malloc(samples_count * PLAN_QUALITIES * sizeof(uint32_t));
+	liner = malloc(samples_count * sizeof(uint32_t));
+	quality = malloc(samples_count * sizeof(int));
+
+	if (!jobs.frames || !liner || !quality) {
+		ok = 0;
+		goto end;
+	}
+
+	result->memory = budget->resident;
+	total = SyroVolcaSample_GetFooterFrameSize();
+
+	for (int i = 0; i < samples_count; i++) {
+		if (!plan_fixed(&syro_data[i])) syro_data[i].DataType = DataType_Sample_Liner;
+		liner[i] = SyroVolcaSample_GetDataFrameSize(&syro_data[i]);
+		quality[i] = PLAN_MAX_QUALITY;
+		result->memory += syro_data[i].Size;
+	}
+
+	// Lossless first, the rest only if needed
+	if (!plan_sizes(&jobs, samples_count, PLAN_MAX_QUALITY, 1)) {
+		ok = 0;
+		goto end;
+	}
+
+	for (int i = 0; i < samples_count; i++)
+		total += plan_frames(jobs.frames, liner, i, PLAN_MAX_QUALITY);
+
+	if (budget->frames && total > budget->frames) {
+		if (!plan_sizes(&jobs, samples_count, PLAN_MIN_QUALITY, PLAN_QUALITIES - 1)) {
+			ok = 0;
+			goto end;
+		}
+
+		plan_lower(jobs.frames, liner, quality, samples_count, budget->frames, &total);
+		if (total <= budget->frames)
+			plan_raise(jobs.frames, liner, quality, samples_count, budget->frames, &total);
+	}
+
+	result->frames = total;
+	result->loss = 0;
+	result->reduced = 0;
+
+	for (int i = 0; i < samples_count; i++) {
+		if (plan_fixed(&syro_data[i])) continue;
+		if (quality[i] == PLAN_MAX_QUALITY
+		    && liner[i] <= plan_frames(jobs.frames, liner, i, PLAN_MAX_QUALITY)) continue;
+
+		syro_data[i].DataType = DataType_Sample_Compress;
+		syro_data[i].Quality = quality[i];
+		result->loss += PLAN_MAX_QUALITY - quality[i];
+		if (quality[i] < PLAN_MAX_QUALITY) result->reduced++;
+	}
+
+	result->fits = (!budget->memory || result->memory <= budget->memory)
+		&& (!budget->frames || result->frames <= budget->frames);
+
+end:
+	free(jobs.frames);
+	free(liner);
+	free(quality);
+
+	return ok;
+}
+
+// ----------------------------------------
+// Split the frames of the stream into header gaps, headers, blocks and
+// erase gaps, per data in split[] and over all of them in *stream, from
+// the sizes alone. Compressed data is sized, not compressed
+// ----------------------------------------
+int plan_layout(SyroData *syro_data, int samples_count, uint32_t resident,
+                SyroFrameSplit *split, plan_stream *stream) {
+
+	memset(stream, 0, sizeof(plan_stream));
+	stream->memory = resident;
+	stream->footer = SyroVolcaSample_GetFooterFrameSize();
+	stream->frames = stream->footer;
+
+	for (int i = 0; i < samples_count; i++) {
+		if (!SyroVolcaSample_GetDataFrameSplit(&syro_data[i], &split[i])) return 0;
+
+		stream->split.Gap += split[i].Gap;
+		stream->split.Header += split[i].Header;
+		stream->split.Block += split[i].Block;
+		stream->split.Erase += split[i].Erase;
+		stream->frames += split[i].Gap + split[i].Header + split[i].Block + split[i].Erase;
+
+		if (!plan_fixed(&syro_data[i])) stream->memory += syro_data[i].Size;
+	}
+
+	return 1;
+}
+
+static void plan_print_row(char *number, char *type, SyroFrameSplit *split, uint32_t frames) {
+	printf("  %-5s %-8s %8.2f %8.2f %8.2f %8.2f %8.2f\n", number, type,
+	       (double) split->Gap / STREAM_FS, (double) split->Header / STREAM_FS,
+	       (double) split->Block / STREAM_FS, (double) split->Erase / STREAM_FS,
+	       (double) frames / STREAM_FS);
+}
+
+static void plan_print(SyroData *syro_data, int samples_count, SyroFrameSplit *split,
+                       plan_stream *stream) {
+
+	SyroFrameSplit footer = { 0, 0, 0, 0 }, total = stream->split;
+	char number[8], type[16];
+
+	printf("  %-5s %-8s %8s %8s %8s %8s %8s\n",
+	       "data", "type", "gap", "header", "blocks", "erase", "seconds");
+
+	for (int i = 0; i < samples_count; i++) {
+		snprintf(number, sizeof(number), "%02u", syro_data[i].Number);
+
+		switch (syro_data[i].DataType) {
+		case DataType_Sample_Liner:
+			snprintf(type, sizeof(type), "sample");
+			break;
+		case DataType_Sample_Compress:
+			snprintf(type, sizeof(type), "comp %u", syro_data[i].Quality);
+			break;
+		case DataType_Sample_Erase:
+			snprintf(type, sizeof(type), "erase");
+			break;
+		case DataType_Pattern:
+			snprintf(number, sizeof(number), "p%u", syro_data[i].Number);
+			snprintf(type, sizeof(type), "pattern");
+			break;
+		default:
+			snprintf(number, sizeof(number), "all");
+			snprintf(type, sizeof(type), "all");
+			break;
+		}
+
+		plan_print_row(number, type, &split[i],
+		               split[i].Gap + split[i].Header + split[i].Block + split[i].Erase);
+	}
+
+	// The footer is a gap of its own, so the total adds up
+	footer.Gap = stream->footer;
+	total.Gap += stream->footer;
+	plan_print_row("", "footer", &footer, stream->footer);
+	plan_print_row("", "total", &total, stream->frames);
+
+	printf("stream: %.2f seconds [%u frames]\n", (double) stream->frames / STREAM_FS,
+	       stream->frames);
+	printf("memory: %u bytes [~%.2f%% of the device]\n", stream->memory,
+	       (100.0 * stream->memory) / DEVICE_MEMORY);
+}
+
+// ----------------------------------------
+// Print the layout of the stream instead of writing it, as the tools do
+// with -n. Returns 0 if some data can't be laid out
+// ----------------------------------------
+int plan_dry_run(SyroData *syro_data, int samples_count, uint32_t resident) {
+
+	SyroFrameSplit *split = malloc(samples_count * sizeof(SyroFrameSplit));
+	plan_stream stream;
+	int ok;
+
+	printf("planning Syro stream (dry run)... ");
+	if (!split) {
+		printf("error! not enough memory\n");
+		return 0;
+	}
+
+	ok = plan_layout(syro_data, samples_count, resident, split, &stream);
+
+	if (ok) {
+		printf("ok!\n");
+		plan_print(syro_data, samples_count, split, &stream);
+	} else {
+		printf("error! invalid data\n");
+	}
+
+	free(split);
+	return ok;
+}
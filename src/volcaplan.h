@@ -0,0 +1,52 @@
+// ----------------------------------------
+//  Compression quality planning under memory and time budgets
+// ----------------------------------------
+
+#ifndef __VOLCAPLAN_H__
+#define __VOLCAPLAN_H__
+
+#include <stdbool.h>
+
+#include "korg/korg_syro_volcasample.h"
+
+#define DEVICE_MEMORY 4194304  // bytes of sample memory in the Volca Sample
+
+#define PLAN_MIN_QUALITY 8
+#define PLAN_MAX_QUALITY 16
+
+typedef struct {
+  uint32_t memory;   // bytes of device memory, 0 for no limit
+  uint32_t frames;   // stream frames, footer included, 0 for no limit
+  uint32_t resident; // bytes taken by samples already in the device
+} plan_budget;
+
+typedef struct {
+  uint32_t memory;   // bytes the samples take in the device, resident included
+  uint32_t frames;   // stream frames, footer included
+  int loss;          // quality bits given up, over all samples
+  int reduced;       // samples sent below 16 bits
+  bool fits;         // both budgets are met
+} plan_result;
+
+typedef struct {
+  SyroFrameSplit split; // over all data
+  uint32_t footer;
+  uint32_t frames;      // stream frames, footer included
+  uint32_t memory;      // bytes the samples take in the device, resident included
+} plan_stream;
+
+// ----------------------------------------
+// Planning
+// ----------------------------------------
+int plan_quality(SyroData *syro_data, int samples_count, plan_budget *budget,
+                 plan_result *result);
+
+// ----------------------------------------
+// Stream layout, without modulating it
+// ----------------------------------------
+int plan_layout(SyroData *syro_data, int samples_count, uint32_t resident,
+                SyroFrameSplit *split, plan_stream *stream);
+int plan_dry_run(SyroData *syro_data, int samples_count, uint32_t resident);
+
+
+#endif  // #ifndef __VOLCAPLAN_H__
@@ -0,0 +1,219 @@
+// ----------------------------------------
+//  Polyphase resampling of mono 16 bit PCM
+// ----------------------------------------
+//
+//  The rate change is done as the reduced fraction up/down of the two
+//  rates, so output frame n sits exactly at input position n*down/up.
+//  The Kaiser windowed sinc filter is stored as one bank of taps per
+//  fractional position (phase), up to RESAMPLE_MAX_PHASES of them. With
+//  more positions than that, the nearest lower phase is used instead.
+//
+//  When downsampling, the filter is widened so that it cuts below the
+//  new Nyquist frequency, e.g., 44100 Hz to 31250 Hz uses 48 taps.
+//
+//  The dot products run four taps at a time, with SSE2 if available.
+//  The scalar kernel adds in the same order, so both give the same
+//  result.
+// ----------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "volcaresample.h"
+
+typedef struct {
+	uint32_t up;           // dest_fs / src_fs as a reduced fraction
+	uint32_t down;
+	uint32_t phase_count;
+	uint32_t tap_count;    // multiple of 4
+	float *coef;           // phase_count banks of tap_count taps
+} resampler;
+
+// ----------------------------------------
+// Rate fraction
+// ----------------------------------------
+static uint32_t gcd(uint32_t a, uint32_t b) {
+	uint32_t t;
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+uint32_t resample_frame_count(uint32_t frame_count, uint32_t src_fs, uint32_t dest_fs) {
+
+	uint32_t div = gcd(src_fs, dest_fs);
+	uint32_t up = dest_fs / div;
+	uint32_t down = src_fs / div;
+
+	// Every output frame whose position falls before the last input frame
+	return (uint32_t) (((uint64_t) frame_count * up + down - 1) / down);
+}
+
+// ----------------------------------------
+// Filter design
+// ----------------------------------------
+
+// Modified Bessel function of the first kind, order 0
+static double bessel_i0(double x) {
+
+	double sum = 1.0, term = 1.0;
+
+	for (int k = 1; term > sum * 1e-12; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+
+	return sum;
+}
+
+static double resample_kernel(double t, double cutoff, double half) {
+
+	double x = t / half;
+	double sinc = t == 0.0 ? 1.0 : sin(M_PI * 2 * cutoff * t) / (M_PI * 2 * cutoff * t);
+
+	if (x <= -1.0 || x >= 1.0) return 0.0;
+
+	return 2 * cutoff * sinc
+	     * bessel_i0(RESAMPLE_BETA * sqrt(1.0 - x * x)) / bessel_i0(RESAMPLE_BETA);
+}
+
+static int resampler_init(resampler *rs, uint32_t src_fs, uint32_t dest_fs) {
+
+	uint32_t div = gcd(src_fs, dest_fs);
+	double scale, cutoff, half, sum;
+	float *bank;
+
+	rs->up = dest_fs / div;
+	rs->down = src_fs / div;
+	rs->phase_count = rs->up < RESAMPLE_MAX_PHASES ? rs->up : RESAMPLE_MAX_PHASES;
+
+	// Cutoff in cycles per input frame
+	scale = rs->up < rs->down ? (double) rs->up / rs->down : 1.0;
+	cutoff = 0.5 * RESAMPLE_CUTOFF * scale;
+
+	rs->tap_count = ((uint32_t) ceil(RESAMPLE_TAPS / scale) + 3) & ~3;
+	if (rs->tap_count > RESAMPLE_MAX_TAPS) rs->tap_count = RESAMPLE_MAX_TAPS;
+	half = rs->tap_count / 2;
+
+	rs->coef = malloc(rs->phase_count * rs->tap_count * sizeof(float));
+	if (!rs->coef) return 0;
+
+	// Tap k of a bank weighs the input frame k - (half - 1) away from
+	// the integer part of the position
+	for (uint32_t p = 0; p < rs->phase_count; p++) {
+		bank = rs->coef + p * rs->tap_count;
+		sum = 0.0;
+
+		for (uint32_t k = 0; k < rs->tap_count; k++) {
+			bank[k] = resample_kernel((double) p / rs->phase_count + half - 1 - k,
+			                          cutoff, half);
+			sum += bank[k];
+		}
+
+		// Unity gain at DC for every phase
+		for (uint32_t k = 0; k < rs->tap_count; k++) bank[k] /= sum;
+	}
+
+	return 1;
+}
+
+// ----------------------------------------
+// Dot product kernels
+// ----------------------------------------
+#ifdef __SSE2__
+static inline float resample_dot(float *src, float *bank, uint32_t tap_count) {
+
+	__m128 acc = _mm_setzero_ps();
+
+	for (uint32_t k = 0; k < tap_count; k += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src + k), _mm_loadu_ps(bank + k)));
+
+	// (a0 + a2) + (a1 + a3)
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+
+	return _mm_cvtss_f32(acc);
+}
+#else
+static inline float resample_dot(float *src, float *bank, uint32_t tap_count) {
+
+	float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	for (uint32_t k = 0; k < tap_count; k += 4) {
+		for (int lane = 0; lane < 4; lane++)
+			acc[lane] += src[k + lane] * bank[k + lane];
+	}
+
+	return (acc[0] + acc[2]) + (acc[1] + acc[3]);
+}
+#endif
+
+static inline int16_t resample_round(float data) {
+	data = data < 32767.0f ? data : 32767.0f;
+	data = data > -32768.0f ? data : -32768.0f;
+	return (int16_t) lrintf(data);
+}
+
+// ----------------------------------------
+// Resample a whole buffer into a new one
+// ----------------------------------------
+int16_t *resample_mono16(int16_t *src, uint32_t frame_count,
+                         uint32_t src_fs, uint32_t dest_fs, uint32_t *pdest_count) {
+
+	resampler rs;
+	uint32_t dest_count, lead;
+	uint64_t pos;
+	float *padded;
+	int16_t *dest;
+
+	if (!src_fs || !dest_fs || !frame_count) return NULL;
+
+	dest_count = resample_frame_count(frame_count, src_fs, dest_fs);
+	dest = malloc(dest_count * sizeof(int16_t));
+	if (!dest) return NULL;
+	*pdest_count = dest_count;
+
+	if (src_fs == dest_fs) {
+		memcpy(dest, src, frame_count * sizeof(int16_t));
+		return dest;
+	}
+
+	if (!resampler_init(&rs, src_fs, dest_fs)) {
+		free(dest);
+		return NULL;
+	}
+
+	// Silence around the input, so that every bank fits at both ends
+	lead = rs.tap_count / 2 - 1;
+	padded = calloc(frame_count + rs.tap_count, sizeof(float));
+	if (!padded) {
+		free(rs.coef);
+		free(dest);
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < frame_count; i++) padded[lead + i] = src[i];
+
+	pos = 0;
+	for (uint32_t n = 0; n < dest_count; n++, pos += rs.down) {
+		uint32_t index = (uint32_t) (pos / rs.up);
+		uint32_t phase = (uint32_t) ((pos % rs.up) * rs.phase_count / rs.up);
+
+		dest[n] = resample_round(resample_dot(padded + index,
+		                                      rs.coef + phase * rs.tap_count,
+		                                      rs.tap_count));
+	}
+
+	free(padded);
+	free(rs.coef);
+
+	return dest;
+}
@@ -0,0 +1,26 @@
+// ----------------------------------------
+//  Polyphase resampling of mono 16 bit PCM
+// ----------------------------------------
+
+#ifndef __VOLCARESAMPLE_H__
+#define __VOLCARESAMPLE_H__
+
+#include <stdint.h>
+
+#define VOLCA_NATIVE_FS 31250
+
+#define RESAMPLE_TAPS       32    // filter taps per phase when upsampling
+#define RESAMPLE_MAX_TAPS   512
+#define RESAMPLE_MAX_PHASES 2048
+#define RESAMPLE_CUTOFF     0.92  // passband edge, relative to Nyquist
+#define RESAMPLE_BETA       8.0   // Kaiser window shape
+
+// ----------------------------------------
+// Resampling
+// ----------------------------------------
+uint32_t resample_frame_count(uint32_t frame_count, uint32_t src_fs, uint32_t dest_fs);
+int16_t *resample_mono16(int16_t *src, uint32_t frame_count,
+                         uint32_t src_fs, uint32_t dest_fs, uint32_t *pdest_count);
+
+
+#endif  // #ifndef __VOLCARESAMPLE_H__
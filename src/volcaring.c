@@ -0,0 +1,120 @@
+// ----------------------------------------
+//  Single producer, single consumer ring of fixed size chunks
+// ----------------------------------------
+//
+//  Each side owns one counter and only reads the other one, so no lock
+//  is needed: the producer fills chunk head % count and then publishes
+//  it by moving head, the consumer drains chunk tail % count and then
+//  hands it back by moving tail. A side that finds the ring full (or
+//  empty) yields a few times and then sleeps in short steps, so that a
+//  slow pipe doesn't keep a core busy.
+// ----------------------------------------
+
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#include "volcaring.h"
+
+#define RING_SPINS    16
+#define RING_SLEEP_NS 100000
+
+int ring_init(ring *pring, uint32_t count) {
+
+	if (!count || count > RING_MAX_COUNT) return 0;
+
+	pring->buffer = malloc((size_t) count * RING_CHUNK_SIZE);
+	pring->length = malloc(count * sizeof(uint32_t));
+	pring->tag = malloc(count * sizeof(int));
+
+	if (!pring->buffer || !pring->length || !pring->tag) {
+		ring_free(pring);
+		return 0;
+	}
+
+	pring->count = count;
+	atomic_init(&pring->head, 0);
+	atomic_init(&pring->tail, 0);
+	pring->full_stalls = 0;
+	pring->empty_stalls = 0;
+
+	return 1;
+}
+
+void ring_free(ring *pring) {
+	free(pring->buffer);
+	free(pring->length);
+	free(pring->tag);
+	pring->buffer = NULL;
+	pring->length = NULL;
+	pring->tag = NULL;
+}
+
+static void ring_wait(int *spins) {
+
+	struct timespec nap = { 0, RING_SLEEP_NS };
+
+	if (*spins < RING_SPINS) {
+		(*spins)++;
+		sched_yield();
+	} else {
+		nanosleep(&nap, NULL);
+	}
+}
+
+// ----------------------------------------
+// Producer side
+// ----------------------------------------
+
+// Wait for a free chunk and return it, to be filled and committed
+uint8_t *ring_acquire(ring *pring) {
+
+	unsigned head = atomic_load_explicit(&pring->head, memory_order_relaxed);
+	int spins = 0;
+
+	if (head - atomic_load_explicit(&pring->tail, memory_order_acquire) == pring->count) {
+		pring->full_stalls++;
+		while (head - atomic_load_explicit(&pring->tail, memory_order_acquire) == pring->count)
+			ring_wait(&spins);
+	}
+
+	return pring->buffer + (size_t) (head % pring->count) * RING_CHUNK_SIZE;
+}
+
+// Publish the acquired chunk, a length of 0 ends the stream
+void ring_commit(ring *pring, uint32_t length, int tag) {
+
+	unsigned head = atomic_load_explicit(&pring->head, memory_order_relaxed);
+
+	pring->length[head % pring->count] = length;
+	pring->tag[head % pring->count] = tag;
+	atomic_store_explicit(&pring->head, head + 1, memory_order_release);
+}
+
+// ----------------------------------------
+// Consumer side
+// ----------------------------------------
+
+// Wait for a committed chunk and return it, to be drained and released
+uint8_t *ring_peek(ring *pring, uint32_t *plength, int *ptag) {
+
+	unsigned tail = atomic_load_explicit(&pring->tail, memory_order_relaxed);
+	int spins = 0;
+
+	if (atomic_load_explicit(&pring->head, memory_order_acquire) == tail) {
+		pring->empty_stalls++;
+		while (atomic_load_explicit(&pring->head, memory_order_acquire) == tail)
+			ring_wait(&spins);
+	}
+
+	*plength = pring->length[tail % pring->count];
+	*ptag = pring->tag[tail % pring->count];
+	return pring->buffer + (size_t) (tail % pring->count) * RING_CHUNK_SIZE;
+}
+
+void ring_release(ring *pring) {
+
+	unsigned tail = atomic_load_explicit(&pring->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&pring->tail, tail + 1, memory_order_release);
+}
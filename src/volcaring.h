@@ -0,0 +1,40 @@
+// ----------------------------------------
+//  Single producer, single consumer ring of fixed size chunks
+// ----------------------------------------
+
+#ifndef __VOLCARING_H__
+#define __VOLCARING_H__
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define RING_CHUNK_SIZE 0x10000
+#define RING_MAX_COUNT  4096
+
+typedef struct {
+  uint8_t *buffer;         // count chunks of RING_CHUNK_SIZE bytes
+  uint32_t *length;        // bytes used in each chunk, 0 ends the stream
+  int *tag;                // caller's value for each chunk
+  uint32_t count;
+  atomic_uint head;        // chunks committed, written by the producer only
+  atomic_uint tail;        // chunks released, written by the consumer only
+  uint32_t full_stalls;    // times the producer waited for a free chunk
+  uint32_t empty_stalls;   // times the consumer waited for a full chunk
+} ring;
+
+// ----------------------------------------
+// Ring handling
+// ----------------------------------------
+int      ring_init(ring *pring, uint32_t count);
+void     ring_free(ring *pring);
+
+// Producer side
+uint8_t *ring_acquire(ring *pring);
+void     ring_commit(ring *pring, uint32_t length, int tag);
+
+// Consumer side
+uint8_t *ring_peek(ring *pring, uint32_t *plength, int *ptag);
+void     ring_release(ring *pring);
+
+
+#endif  // #ifndef __VOLCARING_H__
@@ -0,0 +1,276 @@
+// ----------------------------------------
+//  On disk cache of rendered stream segments
+// ----------------------------------------
+//
+//  Every data in a Syro stream starts with a long gap, long enough for
+//  both channels to settle in the same state whatever came before. The
+//  SDK marks a splice point in there, so the frames from the splice
+//  point of a data to the one of the next only depend on that data: its
+//  contents, type, number and so on, and whether more data follows it
+//  (the continue bit). Those frames are kept in DIR/KEY, KEY being the
+//  hash of all that, along with the state of the channels at both ends:
+//
+//    "VSG1" FRAMES ENTRY_STATE EXIT_STATE, then the frames
+//
+//  When a stream reaches the splice point of a data in the cache with
+//  the channels in its entry state, the frames are read back instead of
+//  rendered, and the SDK skips to the next splice point, leaving the
+//  channels in the exit state. Anything else is rendered as usual and
+//  recorded, through a temporary file renamed once complete.
+// ----------------------------------------
+
+// For mkstemp(), strdup() and snprintf()
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "volcasegment.h"
+#include "volcastate.h"
+#include "volcautils.h"
+
+#define SEGMENT_MAGIC       "VSG1"
+#define SEGMENT_HEADER_SIZE 16
+#define SEGMENT_STEP_FRAMES 8   // one Syro cycle
+
+// ----------------------------------------
+// Keys
+// ----------------------------------------
+
+// Hash of everything the frames of a data depend on. Fields the SDK
+// doesn't use for a data type are left out, as they may be unset
+static uint64_t segment_key(SyroData *data, bool last) {
+
+	uint8_t meta[24] = { 0 };
+	uint64_t hash = data->pData ? state_hash(data->pData, data->Size) : 0;
+
+	for (int i = 0; i < 8; i++) meta[i] = hash >> (i * 8);
+	meta[8] = data->DataType;
+	meta[9] = data->Number;
+	meta[10] = !last;
+	set_32bit_value(meta + 12, data->Size);
+
+	switch (data->DataType) {
+	case DataType_Sample_Compress:
+	case DataType_Sample_AllCompress:
+		meta[11] = data->Quality;
+		// fall through
+	case DataType_Sample_Liner:
+		set_32bit_value(meta + 16, data->Fs);
+		meta[20] = data->SampleEndian;
+		break;
+	default:
+		break;
+	}
+
+	return state_hash(meta, sizeof(meta));
+}
+
+static void segment_path(segment_cache *cache, char *path, size_t size, int index) {
+	snprintf(path, size, "%s/%016llx", cache->dir, (unsigned long long) cache->keys[index]);
+}
+
+int segment_open(segment_cache *cache, char *dir, SyroData *syro_data, int count) {
+
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		printf("error! can't create %s\n", dir);
+		return 0;
+	}
+
+	memset(cache, 0, sizeof(segment_cache));
+	cache->dir = dir;
+	cache->count = count;
+	cache->handled = -1;
+	cache->keys = malloc(count * sizeof(uint64_t));
+	if (!cache->keys) {
+		printf("error! not enough memory\n");
+		return 0;
+	}
+
+	for (int i = 0; i < count; i++)
+		cache->keys[i] = segment_key(&syro_data[i], i + 1 == count);
+
+	return 1;
+}
+
+// ----------------------------------------
+// Recording
+// ----------------------------------------
+static void segment_record(segment_cache *cache, int index, uint32_t state) {
+
+	char path[4096];
+	uint8_t header[SEGMENT_HEADER_SIZE] = { 0 };
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/.tmpXXXXXX", cache->dir);
+	fd = mkstemp(path);
+	if (fd < 0) return;
+
+	cache->recording = fdopen(fd, "wb");
+	if (!cache->recording || fwrite(header, 1, sizeof(header), cache->recording) < sizeof(header)) {
+		if (cache->recording) fclose(cache->recording);
+		else close(fd);
+		unlink(path);
+		cache->recording = NULL;
+		return;
+	}
+
+	cache->record_file = strdup(path);
+	cache->record_data = index;
+	cache->record_frames = 0;
+	cache->record_state = state;
+}
+
+// Keep the segment recorded if it ended in a steady state
+static void segment_finish(segment_cache *cache, bool steady, uint32_t state) {
+
+	char path[4096];
+	uint8_t header[SEGMENT_HEADER_SIZE];
+	bool ok = steady && !ferror(cache->recording);
+
+	if (ok) {
+		memcpy(header, SEGMENT_MAGIC, 4);
+		set_32bit_value(header + 4, cache->record_frames);
+		set_32bit_value(header + 8, cache->record_state);
+		set_32bit_value(header + 12, state);
+		ok = !fseek(cache->recording, 0, SEEK_SET)
+			&& fwrite(header, 1, sizeof(header), cache->recording) == sizeof(header);
+	}
+
+	ok = !fclose(cache->recording) && ok;
+	segment_path(cache, path, sizeof(path), cache->record_data);
+
+	if (ok && !rename(cache->record_file, path)) cache->recorded++;
+	else unlink(cache->record_file);
+
+	free(cache->record_file);
+	cache->record_file = NULL;
+	cache->recording = NULL;
+}
+
+// ----------------------------------------
+// Serving
+// ----------------------------------------
+static bool segment_serve(segment_cache *cache, int index, uint32_t state) {
+
+	char path[4096];
+	uint8_t header[SEGMENT_HEADER_SIZE];
+	uint32_t frames;
+	struct stat st;
+	FILE *fp;
+
+	segment_path(cache, path, sizeof(path), index);
+	fp = fopen(path, "rb");
+	if (!fp) return false;
+
+	if (fread(header, 1, sizeof(header), fp) < sizeof(header)
+	    || memcmp(header, SEGMENT_MAGIC, 4)
+	    || get_32bit_value(header + 8) != state
+	    || fstat(fileno(fp), &st)) {
+		fclose(fp);
+		return false;
+	}
+
+	frames = get_32bit_value(header + 4);
+	if (!frames || frames % 8 || st.st_size != SEGMENT_HEADER_SIZE + (off_t) frames * 4) {
+		fclose(fp);
+		return false;
+	}
+
+	cache->serving = fp;
+	cache->serve_frames = frames;
+	cache->serve_left = frames;
+	cache->serve_state = get_32bit_value(header + 12);
+	return true;
+}
+
+// Splice point of a data: the one recorded so far ends here, and this
+// one is either served from the cache or recorded
+static void segment_splice(segment_cache *cache, SyroHandle handle, int index) {
+
+	uint32_t state = 0;
+	bool steady = SyroVolcaSample_GetSpliceState(handle, &state);
+
+	if (cache->recording) segment_finish(cache, steady, state);
+
+	if (!steady || index >= cache->count) return;
+
+	if (!segment_serve(cache, index, state)) segment_record(cache, index, state);
+}
+
+int segment_get_samples(segment_cache *cache, SyroHandle handle, uint8_t *pdest,
+                        uint32_t frames) {
+
+	uint32_t chunk_frames, to_splice;
+	SyroStatus status;
+	int index;
+
+	while (frames) {
+
+		if (cache->serving) {
+			chunk_frames = MIN(frames, cache->serve_left);
+			cache->serve_left -= chunk_frames;
+
+			// A segment cut short can't be made up for, the stream is lost
+			if (fread(pdest, 4, chunk_frames, cache->serving) < chunk_frames) {
+				fclose(cache->serving);
+				cache->serving = NULL;
+				return 0;
+			}
+
+			if (!cache->serve_left) {
+				status = SyroVolcaSample_SkipData(handle, cache->serve_frames,
+				                                  cache->serve_state);
+				fclose(cache->serving);
+				cache->serving = NULL;
+				if (status != Status_Success) return 0;
+				cache->spliced++;
+			}
+
+		} else {
+			index = SyroVolcaSample_GetSplice(handle, &to_splice);
+
+			if (index >= 0 && !to_splice) {
+				if (index != cache->handled) {
+					cache->handled = index;
+					segment_splice(cache, handle, index);
+					continue;
+				}
+				// Step past it, the SDK then tells how far is safe
+				to_splice = SEGMENT_STEP_FRAMES;
+			}
+
+			chunk_frames = MIN(frames, to_splice);
+			SyroVolcaSample_GetSamples(handle, pdest, chunk_frames);
+
+			if (cache->recording) {
+				fwrite(pdest, 4, chunk_frames, cache->recording);
+				cache->record_frames += chunk_frames;
+			}
+		}
+
+		pdest += chunk_frames * 4;
+		frames -= chunk_frames;
+	}
+
+	return 1;
+}
+
+void segment_close(segment_cache *cache) {
+
+	if (cache->serving) fclose(cache->serving);
+
+	if (cache->recording) {
+		fclose(cache->recording);
+		unlink(cache->record_file);
+		free(cache->record_file);
+	}
+
+	free(cache->keys);
+	cache->keys = NULL;
+	cache->serving = NULL;
+	cache->recording = NULL;
+}
@@ -0,0 +1,47 @@
+// ----------------------------------------
+//  On disk cache of rendered stream segments
+// ----------------------------------------
+
+#ifndef __VOLCASEGMENT_H__
+#define __VOLCASEGMENT_H__
+
+#include <stdio.h>
+
+#include "korg/korg_syro_volcasample.h"
+
+typedef struct {
+  char *dir;
+  uint64_t *keys;        // one per data
+  int count;
+
+  // Segment being served from the cache
+  FILE *serving;
+  uint32_t serve_frames;
+  uint32_t serve_left;
+  uint32_t serve_state;  // channels state at its end
+
+  // Segment being rendered into the cache
+  FILE *recording;
+  char *record_file;
+  int record_data;
+  uint32_t record_frames;
+  uint32_t record_state; // channels state at its start
+
+  int handled;           // last splice point handled
+  int spliced;           // segments taken from the cache
+  int recorded;          // segments rendered and kept
+} segment_cache;
+
+// ----------------------------------------
+// Cache handling
+// ----------------------------------------
+int  segment_open(segment_cache *cache, char *dir, SyroData *syro_data, int count);
+void segment_close(segment_cache *cache);
+
+// Same as SyroVolcaSample_GetSamples, splicing in the cached segments.
+// Returns 0 if a segment can't be read back or skipped in the SDK
+int  segment_get_samples(segment_cache *cache, SyroHandle handle, uint8_t *pdest,
+                         uint32_t frames);
+
+
+#endif  // #ifndef __VOLCASEGMENT_H__
@@ -0,0 +1,122 @@
+// ----------------------------------------
+//  Record of the samples sent to the device
+// ----------------------------------------
+//
+//  The state is a text file with a line per sample in the device:
+//
+//    NUMBER HASH FS SIZE QUALITY
+//
+//  where HASH is the 64 bit FNV-1a hash of the frames, in hex. A missing
+//  file is an empty device. The file is written next to its final name
+//  and renamed over it, so an interrupted run leaves the old one.
+// ----------------------------------------
+
+// For rename() and snprintf()
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "volcastate.h"
+
+#define STATE_HEADER "# volcaload device state: NUMBER HASH FS SIZE QUALITY\n"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+uint64_t state_hash(uint8_t *data, uint32_t size) {
+
+	uint64_t hash = FNV_OFFSET;
+
+	for (uint32_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+int state_read(char *filename, device_state *state) {
+
+	FILE *fp;
+	char line[256];
+	int number, quality, line_count = 0;
+	uint64_t hash;
+	uint32_t fs, size;
+
+	memset(state, 0, sizeof(device_state));
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		if (errno == ENOENT) return 1;
+		printf("error! can't read %s\n", filename);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		line_count++;
+		if (line[0] == '#' || line[0] == '\n') continue;
+
+		if (sscanf(line, "%d %" SCNx64 " %" SCNu32 " %" SCNu32 " %d",
+		           &number, &hash, &fs, &size, &quality) != 5
+		    || number < 0 || number >= STATE_SLOTS) {
+			printf("error! %s:%d: invalid line\n", filename, line_count);
+			fclose(fp);
+			return 0;
+		}
+
+		state->slot[number].used = true;
+		state->slot[number].hash = hash;
+		state->slot[number].fs = fs;
+		state->slot[number].size = size;
+		state->slot[number].quality = quality;
+	}
+
+	fclose(fp);
+	return 1;
+}
+
+int state_write(char *filename, device_state *state) {
+
+	FILE *fp;
+	size_t length = strlen(filename) + 5;
+	char *tmpfile = malloc(length);
+	slot_state *slot;
+	int ok;
+
+	if (!tmpfile) {
+		printf("error! can't write %s\n", filename);
+		return 0;
+	}
+
+	snprintf(tmpfile, length, "%s.tmp", filename);
+
+	fp = fopen(tmpfile, "w");
+	if (!fp) {
+		printf("error! can't write %s\n", tmpfile);
+		free(tmpfile);
+		return 0;
+	}
+
+	fputs(STATE_HEADER, fp);
+
+	for (int i = 0; i < STATE_SLOTS; i++) {
+		slot = &state->slot[i];
+		if (slot->used)
+			fprintf(fp, "%02d %016" PRIx64 " %" PRIu32 " %" PRIu32 " %d\n",
+			        i, slot->hash, slot->fs, slot->size, slot->quality);
+	}
+
+	ok = !ferror(fp);
+	ok = !fclose(fp) && ok && !rename(tmpfile, filename);
+	if (!ok) {
+		printf("error! can't write %s\n", filename);
+		remove(tmpfile);
+	}
+
+	free(tmpfile);
+	return ok;
+}
@@ -0,0 +1,33 @@
+// ----------------------------------------
+//  Record of the samples sent to the device
+// ----------------------------------------
+
+#ifndef __VOLCASTATE_H__
+#define __VOLCASTATE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define STATE_SLOTS 100
+
+typedef struct {
+  bool used;
+  uint64_t hash;     // of the 16 bit frames, as sent
+  uint32_t fs;
+  uint32_t size;     // bytes
+  int quality;       // bits the sample was sent with
+} slot_state;
+
+typedef struct {
+  slot_state slot[STATE_SLOTS];
+} device_state;
+
+// ----------------------------------------
+// State handling
+// ----------------------------------------
+uint64_t state_hash(uint8_t *data, uint32_t size);
+int      state_read(char *filename, device_state *state);
+int      state_write(char *filename, device_state *state);
+
+
+#endif  // #ifndef __VOLCASTATE_H__
@@ -0,0 +1,164 @@
+// ----------------------------------------
+//  Tempo change of mono 16 bit PCM
+// ----------------------------------------
+//
+//  WSOLA (waveform similarity overlap-add): the output is made of Hann
+//  windows half overlapped, each one taken from the input near the
+//  position the new tempo asks for. Within a quarter window around
+//  that position, the segment that best correlates with the natural
+//  continuation of the previous one is used, so the pitch is kept and
+//  the joins stay in phase. This is what ffmpeg's atempo filter, used
+//  by the old volcaconvert script, does as well.
+//
+//  The correlations run four frames at a time, with SSE2 if available.
+//  The scalar kernel adds in the same order, so both give the same
+//  result.
+// ----------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "volcastretch.h"
+
+#define STRETCH_COARSE_STEP 4  // one in four blocks of 4 frames
+
+uint32_t stretch_frame_count(uint32_t frame_count, double speed) {
+	return (uint32_t) (frame_count / speed + 0.5);
+}
+
+// Correlation of two segments, four lanes at a time
+#ifdef __SSE2__
+static inline float stretch_dot(float *a, float *b, uint32_t count, uint32_t step) {
+
+	__m128 acc = _mm_setzero_ps();
+
+	for (uint32_t i = 0; i < count; i += 4 * step)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+
+	return _mm_cvtss_f32(acc);
+}
+#else
+static inline float stretch_dot(float *a, float *b, uint32_t count, uint32_t step) {
+
+	float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	for (uint32_t i = 0; i < count; i += 4 * step) {
+		for (int lane = 0; lane < 4; lane++) acc[lane] += a[i + lane] * b[i + lane];
+	}
+
+	return (acc[0] + acc[2]) + (acc[1] + acc[3]);
+}
+#endif
+
+// Offset within [-tolerance, tolerance] of the segment starting at pos
+// that best matches the overlap of the natural continuation. Every
+// other offset is tried first on a quarter of the overlap, then the
+// best one is refined on all of it
+static int stretch_search(float *src, float *natural, int64_t pos,
+                          uint32_t overlap, int tolerance) {
+
+	float score, best_score = -INFINITY;
+	int best = 0, coarse;
+
+	for (int offset = -tolerance; offset <= tolerance; offset += 2) {
+		score = stretch_dot(src + pos + offset, natural, overlap, STRETCH_COARSE_STEP);
+		if (score > best_score) {
+			best_score = score;
+			best = offset;
+		}
+	}
+
+	coarse = best;
+	best_score = -INFINITY;
+
+	for (int offset = coarse - 1; offset <= coarse + 1; offset++) {
+		if (offset < -tolerance || offset > tolerance) continue;
+
+		score = stretch_dot(src + pos + offset, natural, overlap, 1);
+		if (score > best_score) {
+			best_score = score;
+			best = offset;
+		}
+	}
+
+	return best;
+}
+
+int16_t *stretch_mono16(int16_t *src, uint32_t frame_count, uint32_t fs,
+                        double speed, uint32_t *pdest_count) {
+
+	uint32_t window, hop, dest_count, padded_count;
+	int tolerance;
+	int64_t lead, pos, prev;
+	float *padded, *out, *hann, data;
+	int16_t *dest;
+
+	if (!frame_count || speed < STRETCH_MIN_SPEED || speed > STRETCH_MAX_SPEED) return NULL;
+
+	// Multiple of 8, so that the overlap is made of whole lanes
+	window = (fs * STRETCH_WINDOW_MS / 1000) & ~7;
+	if (window < 8) window = 8;
+	hop = window / 2;
+	tolerance = window / 4;
+
+	dest_count = stretch_frame_count(frame_count, speed);
+	if (!dest_count) return NULL;
+
+	// Window k is centered at output frame k*hop and input frame
+	// k*hop*speed, so both ends need room for half a window plus the
+	// search range, and the last window may start a hop past the end
+	lead = hop + tolerance;
+	padded_count = lead + frame_count + (uint32_t) ceil((hop + 1) * speed) + window + tolerance;
+
+	dest = malloc(dest_count * sizeof(int16_t));
+	padded = calloc(padded_count, sizeof(float));
+	out = calloc(dest_count + window + hop, sizeof(float));
+	hann = malloc(window * sizeof(float));
+
+	if (!dest || !padded || !out || !hann) {
+		free(dest);
+		free(padded);
+		free(out);
+		free(hann);
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < frame_count; i++) padded[lead + i] = src[i];
+
+	// Periodic Hann, adds up to 1 with half overlap
+	for (uint32_t i = 0; i < window; i++)
+		hann[i] = 0.5f - 0.5f * (float) cos(2 * M_PI * i / window);
+
+	prev = 0;
+	for (uint32_t k = 0; (uint64_t) k * hop < (uint64_t) dest_count + hop; k++) {
+
+		pos = lead + (int64_t) llround(k * hop * speed) - hop;
+		if (k) pos += stretch_search(padded, padded + prev + hop, pos, hop, tolerance);
+
+		for (uint32_t i = 0; i < window; i++) out[k * hop + i] += hann[i] * padded[pos + i];
+		prev = pos;
+	}
+
+	// The first half window only fades in the output
+	for (uint32_t n = 0; n < dest_count; n++) {
+		data = out[hop + n];
+		data = data < 32767.0f ? data : 32767.0f;
+		data = data > -32768.0f ? data : -32768.0f;
+		dest[n] = (int16_t) lrintf(data);
+	}
+
+	free(padded);
+	free(out);
+	free(hann);
+
+	*pdest_count = dest_count;
+	return dest;
+}
@@ -0,0 +1,22 @@
+// ----------------------------------------
+//  Tempo change of mono 16 bit PCM
+// ----------------------------------------
+
+#ifndef __VOLCASTRETCH_H__
+#define __VOLCASTRETCH_H__
+
+#include <stdint.h>
+
+#define STRETCH_WINDOW_MS 40  // overlap-add window length
+#define STRETCH_MIN_SPEED 0.25
+#define STRETCH_MAX_SPEED 16.0
+
+// ----------------------------------------
+// Time stretching
+// ----------------------------------------
+uint32_t stretch_frame_count(uint32_t frame_count, double speed);
+int16_t *stretch_mono16(int16_t *src, uint32_t frame_count, uint32_t fs,
+                        double speed, uint32_t *pdest_count);
+
+
+#endif  // #ifndef __VOLCASTRETCH_H__
@@ -0,0 +1,99 @@
+// ----------------------------------------
+//  Silence, DC and erase gap trimming of mono 16 bit PCM
+// ----------------------------------------
+//
+//  Every frame of a sample takes device memory and stream time, the
+//  silent ones included. On top of that, the Syro stream adds an erase
+//  gap of 1000 cycles (~0.18 s) every TRIM_GAP_FRAMES frames, so a sample
+//  just past a multiple of it pays a whole gap for its last few frames.
+//
+//  Trimming drops the frames at both ends that stay within the silence
+//  threshold, then, if the end is at most snap_ms past a gap boundary,
+//  moves it back to the last zero crossing before the boundary. The DC
+//  offset, if removed, is removed first, so the silence is measured
+//  around zero.
+// ----------------------------------------
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "volcatrim.h"
+
+bool trim_enabled(trim_options *options) {
+	return options->threshold || options->dc || options->snap_ms;
+}
+
+// Silence level from a dBFS value, e.g., -60
+int16_t trim_threshold(double db) {
+	double level = 32768.0 * pow(10.0, db / 20.0);
+	return level < 1.0 ? 1 : level > 32767.0 ? 32767 : (int16_t) level;
+}
+
+// ----------------------------------------
+// DC offset
+// ----------------------------------------
+int16_t trim_dc_offset(int16_t *frames, uint32_t frame_count) {
+
+	int64_t sum = 0;
+
+	for (uint32_t i = 0; i < frame_count; i++)
+		sum += frames[i];
+
+	return (int16_t) (sum / (int64_t) frame_count);
+}
+
+void trim_remove_dc(int16_t *frames, uint32_t frame_count, int16_t offset) {
+
+	int32_t value;
+
+	for (uint32_t i = 0; i < frame_count; i++) {
+		value = frames[i] - offset;
+		frames[i] = value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+	}
+}
+
+// ----------------------------------------
+// Ends
+// ----------------------------------------
+
+// Move the end back under the last gap boundary, to a zero crossing, if
+// it doesn't give up more than max_cut frames
+static uint32_t snap_end(int16_t *frames, uint32_t end, uint32_t max_cut) {
+
+	uint32_t boundary = (end - 1) / TRIM_GAP_FRAMES * TRIM_GAP_FRAMES;
+	uint32_t lowest;
+
+	if (!boundary || end - boundary > max_cut) return end;
+	lowest = end > max_cut ? end - max_cut : 1;
+
+	// The last frame kept is zero, or the first dropped crosses it
+	for (uint32_t i = boundary; i > 0 && i >= lowest; i--) {
+		if (!frames[i - 1] || (frames[i - 1] < 0) != (frames[i] < 0))
+			return i;
+	}
+
+	return end;
+}
+
+// Frames of the trimmed sample, starting at frame *pstart. The sample
+// is left as is if it is all silence
+uint32_t trim_mono16(int16_t *frames, uint32_t frame_count, uint32_t fs,
+                     trim_options *options, uint32_t *pstart) {
+
+	uint32_t start = 0, end = frame_count;
+
+	*pstart = 0;
+
+	if (options->threshold) {
+		while (start < end && abs(frames[start]) <= options->threshold) start++;
+		while (end > start && abs(frames[end - 1]) <= options->threshold) end--;
+		if (start == end) return frame_count;
+	}
+
+	if (options->snap_ms)
+		end = start + snap_end(frames + start, end - start,
+		                       (uint32_t) ((uint64_t) options->snap_ms * fs / 1000));
+
+	*pstart = start;
+	return end - start;
+}
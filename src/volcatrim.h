@@ -0,0 +1,32 @@
+// ----------------------------------------
+//  Silence, DC and erase gap trimming of mono 16 bit PCM
+// ----------------------------------------
+
+#ifndef __VOLCATRIM_H__
+#define __VOLCATRIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Frames sent between two erase gaps of a sample, i.e., the Syro
+// SUBSECTOR_SIZE - 2 bytes
+#define TRIM_GAP_FRAMES 2047
+
+typedef struct {
+  int16_t threshold;  // silence level, 0 to keep silences
+  bool dc;            // remove the DC offset
+  uint32_t snap_ms;   // most audio given up to save an erase gap, 0 to never
+} trim_options;
+
+// ----------------------------------------
+// Trimming
+// ----------------------------------------
+bool     trim_enabled(trim_options *options);
+int16_t  trim_threshold(double db);
+int16_t  trim_dc_offset(int16_t *frames, uint32_t frame_count);
+void     trim_remove_dc(int16_t *frames, uint32_t frame_count, int16_t offset);
+uint32_t trim_mono16(int16_t *frames, uint32_t frame_count, uint32_t fs,
+                     trim_options *options, uint32_t *pstart);
+
+
+#endif  // #ifndef __VOLCATRIM_H__
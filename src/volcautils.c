@@ -4,6 +4,12 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include "volcautils.h"
 
@@ -89,6 +95,45 @@ uint8_t *read_file(char *filename, uint32_t *psize) {
 }
 
 
+// Map a whole file read-only into memory, without copying it
+uint8_t *map_file(char *filename, uint32_t *psize) {
+
+	int fd;
+	struct stat st;
+	void *buffer;
+
+	fd = open(filename, O_RDONLY);
+
+	if (fd < 0) {
+		printf("error! file not found\n");
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		printf("error! could not read file\n");
+		close(fd);
+		return NULL;
+	}
+
+	buffer = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (buffer == MAP_FAILED) {
+		printf("error! could not map file\n");
+		return NULL;
+	}
+
+	madvise(buffer, st.st_size, MADV_SEQUENTIAL);
+
+	*psize = st.st_size;
+	return buffer;
+}
+
+void unmap_file(uint8_t *buffer, uint32_t size) {
+	munmap(buffer, size);
+}
+
+
 int write_file(char *filename, uint8_t *buffer, uint32_t size) {
 
 	FILE *fp;
@@ -105,6 +150,424 @@ int write_file(char *filename, uint8_t *buffer, uint32_t size) {
 	return 1;
 }
 
+// Standard output, once the messages are moved to stderr
+static int stream_fd = -1;
+
+// Send every message to stderr from now on, keeping standard output
+// for the Syro stream. Must be called before printing anything
+void redirect_messages(void) {
+	stream_fd = dup(STDOUT_FILENO);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+	setvbuf(stdout, NULL, _IONBF, 0);
+}
+
+// Open the progress sidecar, e.g., a named pipe read by volcaflash.
+// Streaming goes on without it if it can't be opened
+FILE *open_progress(char *filename) {
+
+	FILE *fp = fopen(filename, "w");
+
+	if (!fp) printf("warning! can't write the progress to %s\n", filename);
+	return fp;
+}
+
+// Report the frames handed to the sink so far and the number of the
+// sample being sent (-1 once all of them are), one line at a time
+static void write_progress(FILE *progress, uint32_t done, uint32_t frame, int number) {
+	if (!progress) return;
+	fprintf(progress, "%u %u %d\n", done, frame, number);
+	fflush(progress);
+}
+
+// Frames from the SDK, through the segment cache if any
+static int get_syro_samples(SyroHandle handle, uint8_t *buffer, uint32_t frames,
+                            segment_cache *segments) {
+	if (segments) return segment_get_samples(segments, handle, buffer, frames);
+	SyroVolcaSample_GetSamples(handle, buffer, frames);
+	return 1;
+}
+
+// Convert and write the frames at most STREAM_CHUNK_SIZE bytes at a
+// time, so memory use doesn't grow with the number of frames. With a
+// progress sidecar, PROGRESS_FRAMES at a time
+static int write_syro_frames(FILE *fp, SyroHandle handle, uint32_t frame, FILE *progress,
+                             segment_cache *segments) {
+
+	uint8_t *buffer;
+	uint32_t chunk_frames, max_frames, done = 0;
+
+	max_frames = progress ? PROGRESS_FRAMES : STREAM_CHUNK_SIZE / 4;
+
+	buffer = malloc(max_frames * 4);
+	if (!buffer) {
+		printf("error! not enough memory\n");
+		return 0;
+	}
+
+	while (done < frame) {
+		chunk_frames = MIN(frame - done, max_frames);
+		if (!get_syro_samples(handle, buffer, chunk_frames, segments)) {
+			printf("error reading the segment cache\n");
+			free(buffer);
+			return 0;
+		}
+		if (fwrite(buffer, 4, chunk_frames, fp) < chunk_frames
+		    || (progress && fflush(fp))) {
+			printf("error writing file\n");
+			free(buffer);
+			return 0;
+		}
+		done += chunk_frames;
+		write_progress(progress, done, frame, SyroVolcaSample_GetNumber(handle));
+	}
+
+	free(buffer);
+	return 1;
+}
+
+typedef struct {
+	FILE *fp;
+	ring *pring;
+	FILE *progress;
+	uint32_t frame;
+	bool ok;
+} ring_writer;
+
+// Writer thread, drain the ring until the end of the stream. After an
+// error it keeps releasing chunks, so the generator never blocks
+static void *drain_syro_ring(void *arg) {
+
+	ring_writer *writer = arg;
+	uint8_t *chunk;
+	uint32_t length, piece, done = 0;
+	int number;
+
+	do {
+		chunk = ring_peek(writer->pring, &length, &number);
+
+		// With a progress sidecar, the chunk goes out PROGRESS_FRAMES at a
+		// time, so the progress keeps up with the sink
+		for (uint32_t pos = 0; writer->ok && pos < length; pos += piece) {
+			piece = writer->progress ? MIN(length - pos, PROGRESS_FRAMES * 4) : length;
+			if (fwrite(chunk + pos, 1, piece, writer->fp) < piece
+			    || (writer->progress && fflush(writer->fp))) {
+				writer->ok = false;
+				break;
+			}
+			done += piece / 4;
+			write_progress(writer->progress, done, writer->frame, number);
+		}
+
+		ring_release(writer->pring);
+	} while (length);
+
+	return NULL;
+}
+
+// Same as write_syro_frames, but the frames are generated into the ring
+// while a writer thread drains it, so that the generator never waits
+// on the file unless the whole ring is full. Each chunk carries the
+// number of the sample being sent for the progress sidecar
+static int write_syro_frames_ring(FILE *fp, SyroHandle handle, uint32_t frame,
+                                  ring *pring, FILE *progress, segment_cache *segments) {
+
+	ring_writer writer = { fp, pring, progress, frame, true };
+	pthread_t thread;
+	uint8_t *chunk;
+	uint32_t chunk_frames;
+
+	if (pthread_create(&thread, NULL, drain_syro_ring, &writer)) {
+		return write_syro_frames(fp, handle, frame, progress, segments);
+	}
+
+	// On an error, the chunk acquired ends the stream instead
+	for (; frame; frame -= chunk_frames) {
+		chunk_frames = MIN(frame, RING_CHUNK_SIZE / 4);
+		chunk = ring_acquire(pring);
+		if (!get_syro_samples(handle, chunk, chunk_frames, segments)) break;
+		ring_commit(pring, chunk_frames * 4, SyroVolcaSample_GetNumber(handle));
+	}
+
+	if (!frame) ring_acquire(pring);
+	ring_commit(pring, 0, -1);
+	pthread_join(thread, NULL);
+
+	if (frame) printf("error reading the segment cache\n");
+	else if (!writer.ok) printf("error writing file\n");
+	return !frame && writer.ok;
+}
+
+// Write the WAV header (unless raw) followed by the Syro stream. The
+// file "-" is standard output, see redirect_messages. With a ring, the
+// frames are written by a separate thread, see write_syro_frames_ring
+int write_syro_stream(char *filename, SyroHandle handle, uint32_t frame,
+                      stream_options *options) {
+
+	FILE *fp;
+	uint8_t header[sizeof(wav_header)];
+	int written;
+
+	if (!strcmp(filename, "-")) {
+		fp = stream_fd >= 0 ? fdopen(stream_fd, "wb") : stdout;
+	} else {
+		fp = fopen(filename, "wb");
+	}
+
+	if (!fp) {
+		printf("error opening file\n");
+		return 0;
+	}
+
+	if (!options->raw) {
+		memcpy(header, wav_header, sizeof(wav_header));
+		set_32bit_value(header + WAV_POS_RIFF_SIZE, frame * 4 + 0x24);
+		set_32bit_value(header + WAV_POS_DATA_SIZE, frame * 4);
+		fwrite(header, 1, sizeof(header), fp);
+	}
+
+	written = options->pring
+		? write_syro_frames_ring(fp, handle, frame, options->pring, options->progress,
+		                         options->segments)
+		: write_syro_frames(fp, handle, frame, options->progress, options->segments);
+	fclose(fp);
+
+	return written;
+}
+
+// Write mono 16 bit frames as a plain WAV file
+int write_wav_mono16(char *filename, int16_t *frames, uint32_t frame_count, uint32_t fs) {
+
+	FILE *fp;
+	uint8_t header[WAV_POS_DATA_SIZE + 4];
+	uint8_t *fmt = header + 0x14;
+	uint32_t size = frame_count * 2;
+	bool ok;
+
+	fp = fopen(filename, "wb");
+
+	if (!fp) {
+		printf("error opening file\n");
+		return 0;
+	}
+
+	memcpy(header, wav_header, sizeof(header));
+	set_32bit_value(header + WAV_POS_RIFF_SIZE, size + 0x24);
+	fmt[WAVFMT_POS_CHANNEL] = 1;
+	set_32bit_value(fmt + WAVFMT_POS_FS, fs);
+	set_32bit_value(fmt + WAVFMT_POS_FS + 4, fs * 2);	// Bytes per sec
+	fmt[WAVFMT_POS_BIT - 2] = 2;						// Block Align
+	set_32bit_value(header + WAV_POS_DATA_SIZE, size);
+
+	ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header)
+	  && fwrite(frames, 2, frame_count, fp) == frame_count;
+	fclose(fp);
+
+	if (!ok) printf("error writing file\n");
+	return ok;
+}
+
+// ----------------------------------------
+// WAV parsing
+// ----------------------------------------
+static void parse_wav_fmt(uint8_t *fmt, uint32_t fmt_size, wav_info *info) {
+	info->encoding = get_16bit_value(fmt + WAVFMT_POS_ENCODE);
+	info->channel_count = get_16bit_value(fmt + WAVFMT_POS_CHANNEL);
+	info->fs = get_32bit_value(fmt + WAVFMT_POS_FS);
+	info->bit_depth = get_16bit_value(fmt + WAVFMT_POS_BIT);
+	info->channel_mask = 0;
+
+	// The sub format GUID begins with the actual format code
+	if (info->encoding == WAVE_FORMAT_EXTENSIBLE && fmt_size >= WAVFMT_SIZE_EXTENSIBLE) {
+		info->channel_mask = get_32bit_value(fmt + WAVFMT_POS_CHANNEL_MASK);
+		info->encoding = get_16bit_value(fmt + WAVFMT_POS_SUBFORMAT);
+	}
+}
+
+// Find the format and the payload of a WAV file held in memory. A data
+// size of WAV_SIZE_UNKNOWN, as written by streaming encoders, means the
+// payload runs up to the end of the file
+int parse_wav(uint8_t *src, uint32_t size, wav_info *info) {
+
+	uint32_t wav_pos, payload_size;
+
+	if (size <= sizeof(wav_header)) {
+		printf("error! header too small\n");
+		return 0;
+	}
+
+	if (memcmp(src, wav_header, 4)) {
+		printf("error! missing 'RIFF' header\n");
+		return 0;
+	}
+
+	if (memcmp(src + WAV_POS_WAVEFMT, wav_header + WAV_POS_WAVEFMT, 8)) {
+		printf("error! missing 'WAVE' or 'fmt ' header\n");
+		return 0;
+	}
+
+	wav_pos = WAV_POS_WAVEFMT + 4;
+	payload_size = get_32bit_value(src + wav_pos + 4);
+	parse_wav_fmt(src + wav_pos + 8, MIN(payload_size, size - (wav_pos + 8)), info);
+
+	while (true) {
+		payload_size = get_32bit_value(src + wav_pos + 4);
+		if (!memcmp(src + wav_pos, "data", 4)) break;
+
+		wav_pos += payload_size + 8;
+		if (wav_pos + 8 > size) {
+			printf("error! missing 'data' header\n");
+			return 0;
+		}
+	}
+
+	if (payload_size == WAV_SIZE_UNKNOWN) {
+		payload_size = size - (wav_pos + 8);
+	}
+
+	if (!payload_size) {
+		printf("error! empty payload\n");
+		return 0;
+	}
+
+	if (wav_pos + payload_size + 8 > size) {
+		printf("error! payload size mismatch\n");
+		return 0;
+	}
+
+	info->data = src + wav_pos + 8;
+	info->data_size = payload_size;
+	return 1;
+}
+
+// Read exactly size bytes, or skip them when buffer is NULL
+static int read_stream_bytes(FILE *fp, uint8_t *buffer, uint32_t size) {
+
+	uint8_t skip[4096];
+	uint32_t chunk;
+
+	if (buffer) return fread(buffer, 1, size, fp) == size;
+
+	while (size) {
+		chunk = MIN(size, sizeof(skip));
+		if (fread(skip, 1, chunk, fp) < chunk) return 0;
+		size -= chunk;
+	}
+	return 1;
+}
+
+// Read the chunks of an open WAV stream up to the end of its payload,
+// e.g., the output of a decoder. The returned buffer holds the payload
+uint8_t *read_wav_chunks(FILE *fp, wav_info *info) {
+
+	uint8_t header[12], chunk[8], fmt[WAVFMT_SIZE_EXTENSIBLE];
+	uint32_t fmt_size;
+	uint8_t *buffer, *grown;
+	uint32_t chunk_size, capacity, size = 0;
+	bool has_fmt = false;
+
+	if (!read_stream_bytes(fp, header, sizeof(header))
+	    || memcmp(header, wav_header, 4)
+	    || memcmp(header + WAV_POS_WAVEFMT, wav_header + WAV_POS_WAVEFMT, 4)) {
+		printf("error! missing 'RIFF' or 'WAVE' header\n");
+		return NULL;
+	}
+
+	while (true) {
+		if (!read_stream_bytes(fp, chunk, sizeof(chunk))) {
+			printf("error! missing 'data' header\n");
+			return NULL;
+		}
+		chunk_size = get_32bit_value(chunk + 4);
+
+		if (!memcmp(chunk, "data", 4)) break;
+
+		if (!memcmp(chunk, "fmt ", 4) && chunk_size >= 16) {
+			fmt_size = MIN(chunk_size, sizeof(fmt));
+			if (!read_stream_bytes(fp, fmt, fmt_size)
+			    || !read_stream_bytes(fp, NULL, chunk_size - fmt_size)) {
+				printf("error! truncated 'fmt ' header\n");
+				return NULL;
+			}
+			parse_wav_fmt(fmt, fmt_size, info);
+			has_fmt = true;
+		} else if (!read_stream_bytes(fp, NULL, chunk_size)) {
+			printf("error! missing 'data' header\n");
+			return NULL;
+		}
+	}
+
+	if (!has_fmt) {
+		printf("error! missing 'fmt ' header\n");
+		return NULL;
+	}
+
+	if (chunk_size && chunk_size != WAV_SIZE_UNKNOWN) {
+
+		buffer = malloc(chunk_size);
+		if (!buffer) {
+			printf("error! not enough memory\n");
+			return NULL;
+		}
+		if (!read_stream_bytes(fp, buffer, chunk_size)) {
+			printf("error! payload size mismatch\n");
+			free(buffer);
+			return NULL;
+		}
+		size = chunk_size;
+
+	} else {
+
+		// Unknown size, read until the end of the stream
+		capacity = STREAM_CHUNK_SIZE;
+		buffer = malloc(capacity);
+		while (buffer) {
+			size += fread(buffer + size, 1, capacity - size, fp);
+			if (size < capacity) break;
+
+			capacity *= 2;
+			grown = realloc(buffer, capacity);
+			if (!grown) free(buffer);
+			buffer = grown;
+		}
+		if (!buffer) {
+			printf("error! not enough memory\n");
+			return NULL;
+		}
+	}
+
+	if (!size) {
+		printf("error! empty payload\n");
+		free(buffer);
+		return NULL;
+	}
+
+	info->data = buffer;
+	info->data_size = size;
+	return buffer;
+}
+
+// Read a WAV file from a pipe or stdin ("-") chunk by chunk, without
+// seeking. The returned buffer holds the payload only, and a data size
+// of 0 or WAV_SIZE_UNKNOWN means the payload runs up to the end of the
+// stream
+uint8_t *read_wav_stream(char *filename, wav_info *info) {
+
+	FILE *fp;
+	uint8_t *buffer;
+
+	fp = strcmp(filename, "-") ? fopen(filename, "rb") : stdin;
+
+	if (!fp) {
+		printf("error! file not found\n");
+		return NULL;
+	}
+
+	buffer = read_wav_chunks(fp, info);
+
+	if (fp != stdin) fclose(fp);
+	return buffer;
+}
+
 // ----------------------------------------
 // Deallocate SyroData
 // ----------------------------------------
@@ -117,3 +580,25 @@ void free_syrodata(SyroData *syro_data, int samples_count) {
 		syro_data++;
 	}
 }
+
+// ----------------------------------------
+// Parse a sample number or interval, e.g., 5 or 19-10, into the first
+// and last numbers of it. Returns 0 if arg isn't valid
+// ----------------------------------------
+int parse_sample_range(char *arg, int *pfirst, int *plast) {
+
+	int n1, n2;
+
+	// If the dash appears in the argument, we try to parse it as an interval.
+	// Otherwise we try to parse it as a single number.
+	if (strchr(arg, '-') != NULL) {
+		if (sscanf(arg, "%d-%d", &n1, &n2) != 2 || !VALID(n1) || !VALID(n2)) return 0;
+	} else {
+		if (sscanf(arg, "%d", &n1) != 1 || !VALID(n1)) return 0;
+		n2 = n1;
+	}
+
+	*pfirst = MIN(n1, n2);
+	*plast = MAX(n1, n2);
+	return 1;
+}
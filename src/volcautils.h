@@ -5,12 +5,19 @@
 #ifndef __VOLCAUTILS_H__
 #define __VOLCAUTILS_H__
 
+#include <stdio.h>
+
 #include "korg/korg_syro_volcasample.h"
+#include "volcaring.h"
+#include "volcasegment.h"
 
 #define WAVFMT_POS_ENCODE	 0x00
 #define WAVFMT_POS_CHANNEL 0x02
 #define WAVFMT_POS_FS		   0x04
 #define WAVFMT_POS_BIT		 0x0E
+#define WAVFMT_POS_CHANNEL_MASK 0x14
+#define WAVFMT_POS_SUBFORMAT    0x18
+#define WAVFMT_SIZE_EXTENSIBLE  0x28
 
 #define WAV_POS_RIFF_SIZE	 0x04
 #define WAV_POS_WAVEFMT		 0x08
@@ -20,6 +27,9 @@
 #define RED     "\033[31m"
 #define GREEN   "\033[32m"
 
+#define STREAM_CHUNK_SIZE 0x100000
+#define STREAM_FS         44100
+
 #define MIN(x, y) (x <  y ? x : y)
 #define MAX(x, y) (x >= y ? x : y)
 #define VALID(x) (x >= 0 && x < 100)
@@ -36,16 +46,63 @@ void     set_32bit_value(uint8_t *ptr, uint32_t data);
 uint32_t get_32bit_value(uint8_t *ptr);
 uint16_t get_16bit_value(uint8_t *ptr);
 
+// ----------------------------------------
+// Syro stream output
+// ----------------------------------------
+#define PROGRESS_FRAMES 4410  // 0.1 seconds
+
+typedef struct {
+  bool raw;         // no WAV header
+  ring *pring;      // write on a separate thread through this ring
+  FILE *progress;   // sidecar with "FRAMES_DONE FRAMES NUMBER" lines
+  segment_cache *segments;  // splice in the segments rendered before
+} stream_options;
+
 // ----------------------------------------
 // Files I/O
 // ----------------------------------------
 uint8_t *read_file(char *filename, uint32_t *psize);
+uint8_t *map_file(char *filename, uint32_t *psize);
+void     unmap_file(uint8_t *buffer, uint32_t size);
 int     write_file(char *filename, uint8_t *buffer, uint32_t size);
+void     redirect_messages(void);
+FILE    *open_progress(char *filename);
+int     write_syro_stream(char *filename, SyroHandle handle, uint32_t frame,
+                          stream_options *options);
+int     write_wav_mono16(char *filename, int16_t *frames, uint32_t frame_count, uint32_t fs);
+
+// ----------------------------------------
+// WAV parsing
+// ----------------------------------------
+#define WAV_SIZE_UNKNOWN 0xFFFFFFFF
+
+#define WAVE_FORMAT_PCM        0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+typedef struct {
+  uint16_t encoding;      // sub format of WAVE_FORMAT_EXTENSIBLE files
+  uint32_t channel_mask;  // speaker positions, 0 if unknown
+  uint16_t channel_count;
+  uint16_t bit_depth;
+  uint32_t fs;
+  uint8_t *data;        // 'data' chunk payload
+  uint32_t data_size;   // payload size in bytes
+} wav_info;
+
+int      parse_wav(uint8_t *src, uint32_t size, wav_info *info);
+uint8_t *read_wav_chunks(FILE *fp, wav_info *info);
+uint8_t *read_wav_stream(char *filename, wav_info *info);
 
 // ----------------------------------------
 // Deallocate SyroData
 // ----------------------------------------
 void free_syrodata(SyroData *syro_data, int samples_count);
 
+// ----------------------------------------
+// Sample numbers
+// ----------------------------------------
+int parse_sample_range(char *arg, int *pfirst, int *plast);
+
 
 #endif  // #ifndef VOLCAUTILS_H__